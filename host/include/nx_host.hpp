@@ -0,0 +1,172 @@
+#pragma once
+// Host stand-ins for the parts of libnx the sysmodule uses.
+// Types and signatures follow libnx so source/ compiles unchanged; the hiddbg calls
+// don't talk to anything, they are recorded so a benchmark can see what would have
+// been sent to HID and when.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef u32 Result;
+#define R_SUCCEEDED(res) ((res) == 0)
+#define R_FAILED(res)    ((res) != 0)
+
+#define RGBA8(r,g,b,a)      (((r)&0xff)|(((g)&0xff)<<8)|(((b)&0xff)<<16)|(((a)&0xff)<<24))
+#define RGBA8_MAXALPHA(r,g,b) RGBA8(r,g,b,0xff)
+
+// svc / arm counter
+u64 svcGetSystemTick(void);
+void svcSleepThread(s64 nano);
+static inline u64 armGetSystemTickFreq(void) { return 19200000; }
+static inline u64 armNsToTicks(u64 ns) { return (ns * 12) / 625; }
+static inline u64 armTicksToNs(u64 tick) { return (tick * 625) / 12; }
+
+// hosversion, set to whatever firmware the host build should pretend to run
+#define MAKEHOSVERSION(_major,_minor,_micro) (((u32)(_major) << 16) | ((u32)(_minor) << 8) | (u32)(_micro))
+u32 hosversionGet(void);
+void hosversionSet(u32 version);
+static inline bool hosversionAtLeast(u8 major, u8 minor, u8 micro) { return hosversionGet() >= MAKEHOSVERSION(major, minor, micro); }
+static inline bool hosversionBefore(u8 major, u8 minor, u8 micro) { return !hosversionAtLeast(major, minor, micro); }
+
+// gethostid is what libnx tells the console's IP with. The host build answers it itself, so the bench can
+// pretend the network changed.
+void hostidSet(long id);
+
+// Mutex
+typedef std::mutex Mutex;
+static inline void mutexInit(Mutex*) {}
+static inline void mutexLock(Mutex* m) { m->lock(); }
+static inline void mutexUnlock(Mutex* m) { m->unlock(); }
+
+// Thread, the stack, priority and core arguments are ignored
+typedef void (*ThreadFunc)(void*);
+typedef struct {
+    ThreadFunc entry;
+    void* arg;
+} Thread;
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid);
+Result threadStart(Thread* t);
+
+// LEvent
+typedef struct {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool signaled;
+    bool autoclear;
+} LEvent;
+
+static inline void leventInit(LEvent* le, bool signaled, bool autoclear) { le->signaled = signaled; le->autoclear = autoclear; }
+bool leventWait(LEvent* le, u64 timeout);
+void leventSignal(LEvent* le);
+void leventClear(LEvent* le);
+
+// hid / hiddbg
+typedef enum {
+    HidDeviceType_JoyRight1 = 1,
+    HidDeviceType_JoyLeft2  = 2,
+    HidDeviceType_FullKey3  = 3,
+} HidDeviceType;
+
+typedef enum {
+    HidNpadInterfaceType_Bluetooth = 1,
+    HidNpadInterfaceType_Rail      = 2,
+    HidNpadInterfaceType_USB       = 3,
+    HidNpadInterfaceType_Unknown4  = 4,
+} HidNpadInterfaceType;
+
+typedef struct {
+    s32 x;
+    s32 y;
+} HidAnalogStickState;
+
+typedef struct {
+    u64 handle;
+} HiddbgHdlsHandle;
+
+typedef struct {
+    u64 id;
+} HiddbgHdlsSessionId;
+
+typedef struct {
+    u32 deviceType;
+    u32 npadInterfaceType;
+    u32 singleColorBody;
+    u32 singleColorButtons;
+    u32 colorLeftGrip;
+    u32 colorRightGrip;
+} HiddbgHdlsDeviceInfo;
+
+typedef struct {
+    u32 battery_level;
+    u32 flags;
+    u64 buttons;
+    HidAnalogStickState analog_stick_l;
+    HidAnalogStickState analog_stick_r;
+    u8 six_axis_sensor_acceleration;
+    u8 indicator;
+    u8 padding[2];
+} HiddbgHdlsState;
+
+typedef struct {
+    HiddbgHdlsHandle handle;
+    HiddbgHdlsDeviceInfo device;
+    alignas(8) HiddbgHdlsState state;
+} HiddbgHdlsStateListEntry;
+
+typedef struct {
+    s32 total_entries;
+    u32 pad;
+    HiddbgHdlsStateListEntry entries[0x10];
+} HiddbgHdlsStateList;
+
+Result hiddbgAttachHdlsVirtualDevice(HiddbgHdlsHandle *handle, const HiddbgHdlsDeviceInfo *info);
+Result hiddbgDetachHdlsVirtualDevice(HiddbgHdlsHandle handle);
+Result hiddbgSetHdlsState(HiddbgHdlsHandle handle, const HiddbgHdlsState *state);
+Result hiddbgGetHdlsStateList(HiddbgHdlsSessionId session_id, HiddbgHdlsStateList *state_list);
+Result hiddbgApplyHdlsStateList(HiddbgHdlsSessionId session_id, const HiddbgHdlsStateList *state_list);
+
+namespace host {
+    // What the stand-in hiddbg has been asked to do. Devices get handles 1..maxDevices.
+    struct HiddbgRecorder {
+        static const int maxDevices = 16;
+
+        std::atomic<u64> attachCalls{0};
+        std::atomic<u64> detachCalls{0};
+        std::atomic<u64> setStateCalls{0};
+        std::atomic<u64> getStateListCalls{0};
+        std::atomic<u64> applyStateListCalls{0};
+        std::atomic<u64> failedCalls{0};
+        // Makes both state list calls fail from now on, as a sysmodule that's gone bad would
+        std::atomic<bool> failStateList{false};
+
+        // Device info per handle, returned by hiddbgGetHdlsStateList
+        HiddbgHdlsDeviceInfo devices[maxDevices + 1];
+
+        // Last buttons pushed per handle and the tick it happened at, readable from any thread
+        std::atomic<u64> lastButtons[maxDevices + 1];
+        std::atomic<u64> lastSetTick[maxDevices + 1];
+        std::atomic<bool> attached[maxDevices + 1];
+        // Every button ever pushed per handle, so a press that was only up for one state still shows
+        std::atomic<u64> buttonsSeen[maxDevices + 1];
+
+        // Simulated cost of one IPC round-trip, busy-waited so it shows up in timings
+        std::atomic<u64> ipcCostNs{0};
+
+        void reset();
+    };
+
+    HiddbgRecorder& hiddbgRecorder();
+}
@@ -0,0 +1,1200 @@
+// Host benchmark for the receive -> apply path.
+// Builds con_manager.cpp and udp_manager.cpp against the stand-ins in host/include and drives them
+// the same way the PC client would, over UDP on localhost.
+
+#include "con_manager.hpp"
+#include "udp_manager.hpp"
+#include "config.hpp"
+#include "triple_buffer.hpp"
+#include "jitter_buffer.hpp"
+#include "stage_histograms.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "anarchy.hpp"
+#include <algorithm>
+#include <atomic>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static bool verbose = false;
+static bool sendV2 = false;
+static u32 nextSeq = 1;
+static int historyDepth = 0;
+static int lossPercent = 0;
+static int keyframeInterval = 0;
+static int clientSocket = -1;
+static s64 clientClockOffsetUs = 0;
+static int syncPings = 0;
+
+// Checks that came out wrong, main exits with 1 if there were any
+static int failures = 0;
+
+static const char* check(bool ok, const char* good, const char* bad)
+{
+    if (!ok)
+        failures++;
+    return ok ? good : bad;
+}
+
+static double ticksToUs(u64 ticks)
+{
+    return armTicksToNs(ticks) / 1000.0;
+}
+
+static void printPercentiles(const char* name, std::vector<u64>& samples)
+{
+    if (samples.empty())
+    {
+        printf("%-28s no samples\n", name);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto pct = [&](double p) { return ticksToUs(samples[(size_t)(p * (samples.size() - 1))]); };
+    printf("%-28s n=%zu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n",
+           name, samples.size(), pct(0.5), pct(0.9), pct(0.99), ticksToUs(samples.back()));
+}
+
+static void fillMessage(struct input_message* msg, u16 conCount, u64 keys)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = INPUT_MSG_MAGIC;
+    msg->con_count = conCount;
+    for (int i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        msg->controllers[i].con_type = 1;
+        msg->controllers[i].keys = keys;
+        msg->controllers[i].joy_l_x = (s32)(keys & 0x7fff);
+    }
+}
+
+// The client's clock, -o moves it away from the console's so clock sync has something to find
+static u64 clientTimeUs()
+{
+    return armTicksToNs(svcGetSystemTick()) / 1000 + clientClockOffsetUs;
+}
+
+// Keys the client built each sequence number with, for the history and delta baselines of later datagrams
+static const u32 sentRing = 64;
+static u64 sentKeys[sentRing];
+static u16 sentConCount[sentRing];
+static u32 sentSeq[sentRing];
+
+// Replies (-R, or -d which needs them): newest seq the receiver acknowledged, round-trip times worked
+// out from them, and what the datagrams came to on the wire
+static bool wantReplies = false;
+static bool hasAck = false;
+static u32 ackedSeq = 0;
+static struct input_reply lastReply;
+static u64 replies = 0;
+static std::vector<u64> roundTrips;
+static u64 builtDatagrams = 0, builtBytes = 0, builtDeltas = 0;
+
+static void readReplies()
+{
+    struct input_reply reply;
+    while (clientSocket >= 0 && recv(clientSocket, &reply, sizeof(reply), MSG_DONTWAIT) >= (ssize_t)sizeof(reply))
+    {
+        if (reply.magic != INPUT_REPLY_MAGIC)
+            continue;
+        replies++;
+        lastReply = reply;
+        roundTrips.push_back(armNsToTicks((clientTimeUs() - reply.echo_send_time_us - (reply.reply_time_us - reply.recv_time_us)) * 1000));
+        if (!hasAck || (s32)(reply.acked_seq - ackedSeq) > 0)
+        {
+            ackedSeq = reply.acked_seq;
+            hasAck = true;
+        }
+    }
+}
+
+// Writes the delta section for msg against the datagram the receiver acknowledged last
+static int buildDelta(u8* out, const struct input_message* msg, u16 conCount)
+{
+    struct input_message baseline;
+    fillMessage(&baseline, sentConCount[ackedSeq % sentRing], sentKeys[ackedSeq % sentRing]);
+    struct delta_header header = {ackedSeq};
+    int size = sizeof(header);
+    memcpy(out, &header, sizeof(header));
+
+    for (int i = 0; i < conCount; i++)
+    {
+        struct controller_record base = {0};
+        if (i < baseline.con_count)
+            base = baseline.controllers[i];
+        const struct controller_record& cur = msg->controllers[i];
+        u8* fields = out + size++;
+        *fields = 0;
+
+        u16 conType = cur.con_type;
+        u64 keys = cur.keys;
+        s32 joy[4] = {cur.joy_l_x, cur.joy_l_y, cur.joy_r_x, cur.joy_r_y};
+        s32 baseJoy[4] = {base.joy_l_x, base.joy_l_y, base.joy_r_x, base.joy_r_y};
+        if (conType != base.con_type)
+        {
+            *fields |= DELTA_FIELD_CON_TYPE;
+            memcpy(out + size, &conType, sizeof(conType));
+            size += sizeof(conType);
+        }
+        if (keys != base.keys)
+        {
+            *fields |= DELTA_FIELD_KEYS;
+            memcpy(out + size, &keys, sizeof(keys));
+            size += sizeof(keys);
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            if (joy[j] == baseJoy[j])
+                continue;
+            *fields |= DELTA_FIELD_JOY_L_X << j;
+            memcpy(out + size, &joy[j], sizeof(joy[j]));
+            size += sizeof(joy[j]);
+        }
+    }
+    return size;
+}
+
+// What the PC client would put on the wire, in the format picked with -2. ageUs backdates the send
+// timestamp, as if the datagram had been held up in the network for that long. Button edges since the
+// last datagram and the -H history only go out in v2.
+static int buildDatagram(u8* out, u16 conCount, u64 keys, u32 seq, u64 ageUs = 0, u64 pressed = 0, u64 released = 0)
+{
+    struct input_message msg;
+    fillMessage(&msg, conCount, keys);
+    sentKeys[seq % sentRing] = keys;
+    sentConCount[seq % sentRing] = conCount;
+    sentSeq[seq % sentRing] = seq;
+    builtDatagrams++;
+    if (!sendV2)
+    {
+        builtBytes += sizeof(msg);
+        memcpy(out, &msg, sizeof(msg));
+        return sizeof(msg);
+    }
+
+    // Deltas only against a baseline the receiver still keeps, with a keyframe every -d datagrams
+    bool delta = false;
+    if (wantReplies)
+        readReplies();
+    if (keyframeInterval > 0)
+    {
+        delta = hasAck && seq % keyframeInterval != 0 && (s32)(seq - ackedSeq) > 0 &&
+                seq - ackedSeq < INPUT_MAX_BASELINE_AGE && sentSeq[ackedSeq % sentRing] == ackedSeq;
+    }
+
+    // Only as far back as the frames built in order just before this one
+    u8 history = 0;
+    while (history < historyDepth && history + 1 < (int)sentRing && sentSeq[(seq - history - 1) % sentRing] == seq - history - 1)
+        history++;
+
+    bool edges = (pressed | released) != 0;
+    u8 flags = (edges ? INPUT_FLAG_EDGES : 0) | (history > 0 ? INPUT_FLAG_HISTORY : 0) |
+               (delta ? INPUT_FLAG_DELTA : 0) | (wantReplies ? INPUT_FLAG_REPLY : 0);
+    struct input_message_v2 header = {INPUT_MSG_V2_MAGIC, (u8)conCount, flags, seq, clientTimeUs() - ageUs};
+    int size = sizeof(header);
+    memcpy(out, &header, sizeof(header));
+    if (delta)
+    {
+        size += buildDelta(out + size, &msg, conCount);
+        builtDeltas++;
+    }
+    else
+    {
+        memcpy(out + size, msg.controllers, conCount * sizeof(struct controller_record));
+        size += conCount * sizeof(struct controller_record);
+    }
+    for (int i = 0; edges && i < conCount; i++)
+    {
+        struct edge_record edge = {pressed, released};
+        memcpy(out + size, &edge, sizeof(edge));
+        size += sizeof(edge);
+    }
+    if (history > 0)
+    {
+        struct history_header historyHeader = {history};
+        memcpy(out + size, &historyHeader, sizeof(historyHeader));
+        size += sizeof(historyHeader);
+        for (u32 k = 0; k < history; k++)
+        {
+            u64 keysXor = sentKeys[(seq - k) % sentRing] ^ sentKeys[(seq - k - 1) % sentRing];
+            for (int i = 0; i < conCount; i++)
+            {
+                memcpy(out + size, &keysXor, sizeof(keysXor));
+                size += sizeof(keysXor);
+            }
+        }
+    }
+    builtBytes += size;
+    return size;
+}
+
+// Taps of one datagram down, one up, sent over a link that drops -l percent of datagrams. Each tap is
+// followed by a datagram that always gets through, as the client would keep sending while idle.
+static void lossyTaps(int client, const struct sockaddr_in* dest, u64 keys, int taps)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    const u64 tap = 0x2;
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    int seen = 0, dropped = 0;
+    srand(1);
+    keys &= ~tap;
+
+    for (int t = 0; t < taps; t++)
+    {
+        rec.buttonsSeen[1] = 0;
+        u64 frames[3] = {keys | tap, keys, keys};
+        for (int f = 0; f < 3; f++)
+        {
+            int size = buildDatagram(datagram, 1, frames[f], nextSeq++);
+            if (f < 2 && rand() % 100 < lossPercent)
+            {
+                dropped++;
+                continue;
+            }
+            sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+            svcSleepThread(1000000);
+        }
+        svcSleepThread((s64)(config.tap_hold_us + 5000) * 1000);
+        if (rec.buttonsSeen[1] & tap)
+            seen++;
+    }
+
+    // Two frames of history cover both datagrams a tap can be lost in, a majority vote never sees taps
+    bool majority = config.anarchy && config.anarchy_buttons == ANARCHY_BUTTONS_MAJORITY;
+    const char* verdict = "";
+    if (historyDepth >= 2 && !majority)
+        verdict = check(seen == taps, ", all recovered", ", MISSED");
+    printf("%-28s %d/%d seen with %d%% loss and %d frames of history (%d datagrams dropped, %llu rebuilt, %llu lost)%s\n",
+           "taps over a lossy link", seen, taps, lossPercent, historyDepth, dropped,
+           (unsigned long long)metric_get(METRIC_RECOVERED), (unsigned long long)metric_get(METRIC_LOST), verdict);
+}
+
+// A second player running a client of their own: it has to get a slot of its own, and its sequence
+// numbers (starting over at 1) must not count as stale next to the first client's. Its clock is a few
+// seconds off from the first client's, which mustn't hold up the jitter buffer.
+static void secondClient(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    int other = socket(AF_INET, SOCK_DGRAM, 0);
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    const u64 otherKeys = 0x5a5a;
+    const s64 otherClockUs = 5000000;
+
+    for (u32 seq = 1; seq <= 3; seq++)
+    {
+        struct input_message msg;
+        fillMessage(&msg, 1, otherKeys + seq);
+        struct input_message_v2 header = {INPUT_MSG_V2_MAGIC, 1, 0, seq, clientTimeUs() + otherClockUs};
+        memcpy(datagram, &header, sizeof(header));
+        memcpy(datagram + sizeof(header), msg.controllers, sizeof(struct controller_record));
+        sendto(other, datagram, sizeof(header) + sizeof(struct controller_record), 0, (const struct sockaddr*)dest, sizeof(*dest));
+
+        int size = buildDatagram(datagram, 1, keys + seq, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(10000000);
+    }
+    close(other);
+
+    if (config.jitter_buffer)
+    {
+        const JitterBuffer* jitter = get_jitter_buffer();
+        printf("%-28s target delay %.0fus -> %s\n", "jitter with two clocks", ticksToUs(jitter->target_delay),
+               check(jitter->target_delay < armNsToTicks(config.jitter_max_us * 1000), "own transit per client", "PINNED AT MAX"));
+    }
+
+    if (config.anarchy)
+    {
+        // Both on slot 0, the first client sent last
+        u64 a = keys + 3, b = otherKeys + 3;
+        u64 expected = config.anarchy_buttons == ANARCHY_BUTTONS_OR ? a | b : config.anarchy_buttons == ANARCHY_BUTTONS_MAJORITY ? a & b : a;
+        printf("%-28s %s\n", "two clients (anarchy)", check(rec.lastButtons[1] == expected, "merged", "WRONG"));
+    }
+    else
+    {
+        bool ownSlot = rec.lastButtons[2] == otherKeys + 3;
+        bool firstIntact = rec.lastButtons[1] == keys + 3;
+        printf("%-28s second client %s, first client %s\n", "two clients", check(ownSlot, "on slot 1", "MISSING"),
+               check(firstIntact, "untouched", "OVERWRITTEN"));
+    }
+
+    // The second player drops out for good while the first one keeps playing
+    if (config.input_timeout_ms == 0)
+        return;
+    u64 until = svcGetSystemTick() + armNsToTicks((config.input_timeout_ms + 50) * 1000000);
+    while (svcGetSystemTick() < until)
+    {
+        int size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(10000000);
+    }
+    if (config.anarchy)
+    {
+        // Both share slot 0, what's left of the merge must be the first client alone
+        printf("%-28s dropped client %s\n", "input timeout", check(rec.lastButtons[1] == keys, "left the merge", "STUCK"));
+    }
+    else
+    {
+        printf("%-28s dropped client %s, first client %s\n", "input timeout", check(rec.lastButtons[2] == 0, "released", "STUCK"),
+               check(rec.lastButtons[1] == keys, "still playing", "RELEASED"));
+
+        // The first client wants a second controller, which takes the idle client's slot in the same
+        // datagram that frees it. Its old controller has to be unplugged, not handed over.
+        u64 detaches = rec.detachCalls;
+        int size = buildDatagram(datagram, 2, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(50000000);
+        printf("%-28s old controller %s, new one %s\n", "slot taken over", check(rec.detachCalls > detaches, "unplugged", "HANDED OVER"),
+               check(rec.attached[2] && rec.lastButtons[2] == keys, "playing", "MISSING"));
+    }
+}
+
+// Two more players behind the same NAT as the first client: one plays and pauses, then the other one
+// starts. It must get a slot of its own rather than take over the paused player's.
+static void natPlayers(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    const u64 pausedKeys = 0x3c3c, newKeys = 0x4242;
+    auto sendFrom = [&](int sock, u64 buttons) {
+        struct input_message msg;
+        fillMessage(&msg, 1, buttons);
+        struct input_message_v2 header = {INPUT_MSG_V2_MAGIC, 1, 0, 1, clientTimeUs()};
+        memcpy(datagram, &header, sizeof(header));
+        memcpy(datagram + sizeof(header), msg.controllers, sizeof(struct controller_record));
+        sendto(sock, datagram, sizeof(header) + sizeof(struct controller_record), 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(50000000);
+    };
+
+    int paused = socket(AF_INET, SOCK_DGRAM, 0);
+    sendFrom(paused, pausedKeys);
+    int pausedHandle = 0;
+    for (int h = 1; h <= host::HiddbgRecorder::maxDevices; h++)
+    {
+        if (rec.attached[h] && rec.lastButtons[h] == pausedKeys)
+            pausedHandle = h;
+    }
+
+    u64 until = svcGetSystemTick() + armNsToTicks((config.session_timeout_ms + 50) * 1000000);
+    while (svcGetSystemTick() < until)
+    {
+        int size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(10000000);
+    }
+
+    int other = socket(AF_INET, SOCK_DGRAM, 0);
+    sendFrom(other, newKeys);
+    close(paused);
+    close(other);
+    bool ownSlot = pausedHandle != 0 && rec.lastButtons[pausedHandle] != newKeys;
+    printf("%-28s new player %s\n", "players behind one NAT", check(ownSlot, "on a slot of its own", "TOOK THE PAUSED ONE'S"));
+}
+
+// Someone else has a device of their own attached, then a state list call fails once: the list is fetched
+// again and used from then on, with only our entries in it. After failing a few times in a row every
+// controller goes through SetHdlsState, without trying the list again each frame.
+static void failingStateList(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    const int datagrams = 20;
+    auto sendSome = [&](int count) {
+        for (int i = 0; i < count; i++)
+        {
+            int size = buildDatagram(datagram, 1, ++keys, nextSeq++);
+            sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+            svcSleepThread(10000000);
+        }
+        svcSleepThread(50000000);
+    };
+
+    HiddbgHdlsDeviceInfo device = {};
+    HiddbgHdlsHandle foreign;
+    hiddbgAttachHdlsVirtualDevice(&foreign, &device);
+
+    rec.failStateList = true;
+    sendSome(1);
+    rec.failStateList = false;
+    u64 applies = rec.applyStateListCalls;
+    sendSome(2);
+    const u64 foreignButtons = 0xf00;
+    rec.lastButtons[foreign.handle] = foreignButtons;
+    sendSome(2);
+    printf("%-28s list %s, someone else's device %s\n", "state list failing once",
+           check(rec.applyStateListCalls > applies, "used again", "GIVEN UP"),
+           check(rec.lastButtons[foreign.handle] == foreignButtons, "left alone", "OVERWRITTEN"));
+    hiddbgDetachHdlsVirtualDevice(foreign);
+
+    rec.failStateList = true;
+    u64 listCalls = rec.getStateListCalls + rec.applyStateListCalls;
+    sendSome(datagrams);
+    u64 tries = rec.getStateListCalls + rec.applyStateListCalls - listCalls;
+    printf("%-28s %llu list calls for %d datagrams (%s), input %s\n", "failing state list", (unsigned long long)tries, datagrams,
+           check(tries <= 3, "gave up", "RETRIED"), check(rec.lastButtons[1] == keys, "still applied", "LOST"));
+}
+
+// The biggest datagram a client can send: all 8 controllers, edges and INPUT_MAX_HISTORY frames of history.
+// None of it may be cut off and thrown away as invalid.
+static void fullDatagrams(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    int savedHistory = historyDepth;
+    historyDepth = INPUT_MAX_HISTORY;
+
+    u64 invalid = metric_get(METRIC_INVALID);
+    int size = 0;
+    for (int i = 0; i < INPUT_MAX_HISTORY + 2; i++)
+    {
+        size = buildDatagram(datagram, MAX_CONTROLLERS, ++keys, nextSeq++, 0, 0x4, 0x4);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(5000000);
+    }
+    svcSleepThread(50000000);
+    historyDepth = savedHistory;
+
+    printf("%-28s %d bytes, %s, %s\n", "full datagrams", size, check(metric_get(METRIC_INVALID) == invalid, "accepted", "INVALID"),
+           check(rec.lastButtons[1] == keys, "applied", "NOT APPLIED"));
+}
+
+// The console's IP changes under us: the socket has to be rebuilt on the next address check, and input
+// from the client has to keep coming in through the new one
+static void addressChange(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    u64 rebuilds = metric_get(METRIC_SOCKET_REBUILDS);
+
+    hostidSet(0x0200a8c0);
+    u64 until = svcGetSystemTick() + armNsToTicks(1500000000);
+    while (svcGetSystemTick() < until && metric_get(METRIC_SOCKET_REBUILDS) == rebuilds)
+    {
+        int size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(20000000);
+    }
+    bool rebuilt = metric_get(METRIC_SOCKET_REBUILDS) > rebuilds;
+
+    for (int i = 0; i < 10 && rec.lastButtons[1] != keys + 1; i++)
+    {
+        int size = buildDatagram(datagram, 1, keys + 1, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(20000000);
+    }
+    printf("%-28s socket %s, input %s\n", "address change", check(rebuilt, "rebuilt", "KEPT"),
+           check(rec.lastButtons[1] == keys + 1, "still coming in", "LOST"));
+}
+
+// The client restarts and numbers its datagrams from 1 again, without pausing. Those look stale at
+// first, but must not keep the session alive: once it's been session_timeout_ms since the last one we
+// took, the new numbering is picked up.
+static void clientRestart(int client, const struct sockaddr_in* dest, u64 keys)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    nextSeq = 1;
+    u64 until = svcGetSystemTick() + armNsToTicks((config.session_timeout_ms + 500) * 1000000);
+    while (svcGetSystemTick() < until && rec.lastButtons[1] != keys)
+    {
+        int size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (const struct sockaddr*)dest, sizeof(*dest));
+        svcSleepThread(10000000);
+    }
+    printf("%-28s input %s after %u datagrams\n", "client restart", check(rec.lastButtons[1] == keys, "taken", "LOCKED OUT"),
+           nextSeq - 1);
+}
+
+// What a fleet monitor would do: one stats_request from a socket of its own, every metric printed by name
+static void queryStats(const struct sockaddr_in* dest)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // A bare request gets nothing, the reply would be bigger than it. Padded, it has room for every metric.
+    struct stats_request request = {STATS_REQUEST_MAGIC, 0, 42};
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    sendto(sock, &request, sizeof(request), 0, (const struct sockaddr*)dest, sizeof(*dest));
+    bool bareAnswered = recv(sock, datagram, sizeof(datagram), 0) >= 0;
+    printf("%-28s %s\n", "unpadded stats query", check(!bareAnswered, "ignored", "ANSWERED"));
+
+    int requestSize = sizeof(struct stats_reply) + METRIC_COUNT * sizeof(u64);
+    memset(datagram, 0, requestSize);
+    memcpy(datagram, &request, sizeof(request));
+    sendto(sock, datagram, requestSize, 0, (const struct sockaddr*)dest, sizeof(*dest));
+    int n = recv(sock, datagram, sizeof(datagram), 0);
+    close(sock);
+
+    const struct stats_reply* reply = (const struct stats_reply*)datagram;
+    if (n < (int)sizeof(*reply) || reply->magic != STATS_REPLY_MAGIC || reply->id != request.id ||
+        n < (int)(sizeof(*reply) + reply->count * sizeof(u64)))
+    {
+        printf("%-28s %s\n", "stats query", check(false, "", "NO REPLY"));
+        return;
+    }
+
+    printf("%-28s %u metrics, uptime %.3fs:", "stats query", reply->count, reply->uptime_us / 1e6);
+    for (u32 i = 0; i < reply->count && i < METRIC_COUNT; i++)
+    {
+        u64 value;
+        memcpy(&value, datagram + sizeof(*reply) + i * sizeof(u64), sizeof(value));
+        if (value != 0)
+            printf(" %s=%llu", metric_names[i], (unsigned long long)value);
+    }
+    printf("\n");
+}
+
+// Pings are padded to the size of a pong, shorter ones aren't answered
+static void sendPing(int sock, const struct time_ping* ping, const struct sockaddr_in* dest)
+{
+    u8 padded[sizeof(struct time_pong)] = {0};
+    memcpy(padded, ping, sizeof(*ping));
+    sendto(sock, padded, sizeof(padded), 0, (const struct sockaddr*)dest, sizeof(*dest));
+}
+
+// Ping/pong from a socket of its own, as the client would do in the background. Each ping reports when
+// the previous pong arrived so the console can work out the offset. Returns the last pong.
+static struct time_pong exchangePings(const struct sockaddr_in* dest, int pings)
+{
+    static u32 nextPingId = 1;
+    static u32 prevId = 0;
+    static u64 prevRecvUs = 0;
+    struct time_pong pong = {0};
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    for (int i = 0; i < pings; i++)
+    {
+        struct time_ping ping = {TIME_PING_MAGIC, 0, nextPingId++, clientTimeUs(), prevId, 0, prevRecvUs};
+        sendPing(sock, &ping, dest);
+        if (recv(sock, &pong, sizeof(pong), 0) == sizeof(pong) && pong.magic == TIME_PONG_MAGIC && pong.id == ping.id)
+        {
+            prevId = pong.id;
+            prevRecvUs = clientTimeUs();
+        }
+        svcSleepThread(2000000);
+    }
+    close(sock);
+    return pong;
+}
+
+// Another machine with a clock of its own pings from 127.0.0.2, with the same ping ids the first client
+// used. Each of them has to get its own offset back.
+static void secondClock(const struct sockaddr_in* dest)
+{
+    const s64 shiftUs = 5000000;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in source;
+    memset(&source, 0, sizeof(source));
+    source.sin_family = AF_INET;
+    source.sin_addr.s_addr = inet_addr("127.0.0.2");
+    bind(sock, (const struct sockaddr*)&source, sizeof(source));
+    struct timeval timeout = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct time_pong pong = {0};
+    u32 prevId = 0;
+    u64 prevRecvUs = 0;
+    for (u32 id = 1; id <= (u32)syncPings; id++)
+    {
+        struct time_ping ping = {TIME_PING_MAGIC, 0, id, clientTimeUs() + shiftUs, prevId, 0, prevRecvUs};
+        sendPing(sock, &ping, dest);
+        if (recv(sock, &pong, sizeof(pong), 0) == sizeof(pong) && pong.magic == TIME_PONG_MAGIC && pong.id == ping.id)
+        {
+            prevId = pong.id;
+            prevRecvUs = clientTimeUs() + shiftUs;
+        }
+        svcSleepThread(2000000);
+    }
+    close(sock);
+
+    struct time_pong own = exchangePings(dest, 2);
+    bool otherRight = pong.offset_known && llabs(pong.offset_us + clientClockOffsetUs + shiftUs) < 1000;
+    bool ownRight = own.offset_known && llabs(own.offset_us + clientClockOffsetUs) < 1000;
+    printf("%-28s other machine's offset %s (%lldus), first client's %s (%lldus)\n", "second clock",
+           check(otherRight, "its own", "WRONG"), (long long)pong.offset_us, check(ownRight, "untouched", "WRONG"),
+           (long long)own.offset_us);
+}
+
+// Someone who isn't playing: a bare ping must go unanswered, and pings from more new addresses than
+// there are clock slots must not cost the clients that are still pinging their offsets
+static void spoofedPings(const struct sockaddr_in* dest)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {0, 200000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct time_ping ping = {TIME_PING_MAGIC, 0, 1, clientTimeUs(), 0, 0, 0};
+    sendto(sock, &ping, sizeof(ping), 0, (const struct sockaddr*)dest, sizeof(*dest));
+    struct time_pong pong;
+    bool answered = recv(sock, &pong, sizeof(pong), 0) > 0;
+    close(sock);
+
+    for (int i = 0; i < 8; i++)
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in source;
+        memset(&source, 0, sizeof(source));
+        source.sin_family = AF_INET;
+        source.sin_addr.s_addr = htonl(0x7f000010 + i);
+        bind(sock, (const struct sockaddr*)&source, sizeof(source));
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sendPing(sock, &ping, dest);
+        recv(sock, &pong, sizeof(pong), 0);
+        close(sock);
+    }
+
+    struct time_pong own = exchangePings(dest, 1);
+    printf("%-28s short ping %s, offset after 8 strangers %s\n", "spoofed pings",
+           check(!answered, "ignored", "ANSWERED"), check(own.offset_known, "kept", "LOST"));
+}
+
+// Cost of apply_fake_con_state alone with every slot in use, once with input that changes every
+// iteration and once with the same input over and over
+static void benchApply(int iterations)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    struct input_frame frame = {};
+    fillMessage(&frame.message, 8, 0);
+    apply_fake_con_state(&frame);
+
+    for (int idle = 0; idle < 2; idle++)
+    {
+        u64 setCalls = rec.setStateCalls;
+        u64 listCalls = rec.getStateListCalls + rec.applyStateListCalls;
+        u64 start = svcGetSystemTick();
+        for (int i = 0; i < iterations; i++)
+        {
+            fillMessage(&frame.message, 8, idle ? 1 : i + 2);
+            apply_fake_con_state(&frame);
+        }
+        u64 elapsed = svcGetSystemTick() - start;
+
+        printf("%-28s %d iterations, %.3fus/iter, IPC/iter: %.2f SetHdlsState %.2f HdlsStateList\n",
+               idle ? "apply (8 slots, idle)" : "apply (8 slots, changing)", iterations, ticksToUs(elapsed) / iterations,
+               (double)(rec.setStateCalls - setCalls) / iterations,
+               (double)(rec.getStateListCalls + rec.applyStateListCalls - listCalls) / iterations);
+    }
+}
+
+// Latency from sendto() on the client side to the stand-in hiddbg seeing the new buttons.
+// Each step sends a burst of datagrams back to back and times the last one. Their timestamps are
+// one send interval apart, like a client sending steadily through a link that delivers in bursts.
+static void benchNetwork(int packets, int sendIntervalUs, int burst)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    startInputThreads();
+
+    int client = socket(AF_INET, SOCK_DGRAM, 0);
+    clientSocket = client;
+    struct sockaddr_in dest;
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(8000);
+    dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<u64> latencies;
+    latencies.reserve(packets);
+    int lost = 0;
+    u64 keys = 0x1000000;
+    u8 datagram[MAX_DATAGRAM_SIZE];
+    int size = 0;
+
+    // The first poll rebuilds the socket, keep sending until something gets through
+    for (int warmup = 0; warmup < 100 && rec.lastButtons[1] != keys; warmup++)
+    {
+        size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        svcSleepThread(20000000);
+    }
+
+    if (syncPings > 0)
+    {
+        struct time_pong pong = exchangePings(&dest, syncPings);
+        printf("%-28s %d pings, offset %s: %lldus (client clock moved by %lldus)\n", "clock sync", syncPings,
+               check(pong.offset_known, "known", "UNKNOWN"), (long long)pong.offset_us, (long long)clientClockOffsetUs);
+        if (syncPings > 1)
+        {
+            secondClock(&dest);
+            spoofedPings(&dest);
+        }
+    }
+
+    const u64 timeout = armNsToTicks(200000000);
+    for (int i = 0; i < packets; i++)
+    {
+        u64 sent = svcGetSystemTick();
+        for (int b = 0; b < burst; b++)
+        {
+            keys++;
+            size = buildDatagram(datagram, 1, keys, nextSeq++, (u64)(burst - 1 - b) * sendIntervalUs);
+            sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        }
+        while (rec.lastButtons[1] != keys && svcGetSystemTick() - sent < timeout)
+            std::this_thread::yield();
+        if (rec.lastButtons[1] == keys)
+            latencies.push_back(rec.lastSetTick[1] - sent);
+        else
+            lost++;
+        if (sendIntervalUs > 0)
+            svcSleepThread((s64)sendIntervalUs * 1000);
+    }
+
+    if (syncPings > 0)
+    {
+        // What the console measured itself, as any client would see it in a pong
+        struct time_pong pong = exchangePings(&dest, 2);
+        printf("%-28s network p50=%uus p99=%uus, queue p50=%uus p99=%uus, total p50=%uus p99=%uus\n", "console-side latency",
+               pong.network_p50_us, pong.network_p99_us, pong.queue_p50_us, pong.queue_p99_us, pong.total_p50_us, pong.total_p99_us);
+    }
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        const LogHistogram* histogram = get_stage_histogram((latency_stage)stage);
+        char name[32];
+        snprintf(name, sizeof(name), "stage %s", latency_stage_names[stage]);
+        printf("%-28s n=%llu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus\n", name, (unsigned long long)histogram->count(),
+               ticksToUs(histogram->percentile(50)), ticksToUs(histogram->percentile(90)),
+               ticksToUs(histogram->percentile(99)), ticksToUs(histogram->max()));
+    }
+
+    printf("%-28s %s, %d bytes per datagram, bursts of %d\n", "wire format", sendV2 ? "v2" : "legacy", size, burst);
+    if (keyframeInterval > 0)
+    {
+        printf("%-28s keyframe every %d, %llu of %llu datagrams were deltas, %.1f bytes on average, unresolved=%llu\n",
+               "delta encoding", keyframeInterval, (unsigned long long)builtDeltas, (unsigned long long)builtDatagrams,
+               (double)builtBytes / builtDatagrams, (unsigned long long)metric_get(METRIC_UNRESOLVED));
+    }
+    printPercentiles("send -> hiddbg latency", latencies);
+    printf("%-28s %d\n", "lost (200ms timeout)", lost);
+    printf("%-28s received=%llu invalid=%llu stale=%llu coalesced=%llu recovered=%llu lost=%llu\n", "receiver counters",
+           (unsigned long long)metric_get(METRIC_RECEIVED), (unsigned long long)metric_get(METRIC_INVALID),
+           (unsigned long long)metric_get(METRIC_STALE), (unsigned long long)metric_get(METRIC_COALESCED),
+           (unsigned long long)metric_get(METRIC_RECOVERED), (unsigned long long)metric_get(METRIC_LOST));
+
+    if (config.jitter_buffer)
+    {
+        const JitterBuffer* jitter = get_jitter_buffer();
+        printf("%-28s target delay=%.1fus late=%llu dropped=%llu skipped=%llu\n", "jitter buffer",
+               ticksToUs(jitter->target_delay), (unsigned long long)jitter->late.load(),
+               (unsigned long long)jitter->dropped.load(), (unsigned long long)jitter->skipped.load());
+    }
+
+    const struct scheduler_stats* sched = get_scheduler_stats();
+    u64 wakeups = sched->wakeups.load();
+    if (wakeups > 0)
+    {
+        u64 period = config.apply_period_us == 0 && config.jitter_buffer ? 5000 : config.apply_period_us;
+        printf("%-28s period=%lluus wakeups=%llu overruns=%llu lateness avg=%.1fus max=%.1fus\n", "apply scheduler",
+               (unsigned long long)period, (unsigned long long)wakeups, (unsigned long long)sched->overruns.load(),
+               ticksToUs(sched->jitter_sum.load()) / wakeups, ticksToUs(sched->jitter_max.load()));
+    }
+
+    if (wantReplies && sendV2)
+    {
+        svcSleepThread((s64)(config.reply_interval_ms + 20) * 1000000);
+        readReplies();
+        // Someone spoofing a 16 byte datagram that asks for a reply, twice: 32 bytes mustn't get 60 back
+        int spoofer = socket(AF_INET, SOCK_DGRAM, 0);
+        struct timeval timeout = {0, (long)(config.reply_interval_ms + 50) * 1000};
+        setsockopt(spoofer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        for (u32 seq = 1; seq <= 2; seq++)
+        {
+            struct input_message_v2 header = {INPUT_MSG_V2_MAGIC, 0, INPUT_FLAG_REPLY, seq, clientTimeUs()};
+            sendto(spoofer, &header, sizeof(header), 0, (struct sockaddr*)&dest, sizeof(dest));
+        }
+        u8 reply[MAX_DATAGRAM_SIZE];
+        bool amplified = recv(spoofer, reply, sizeof(reply), 0) > 0;
+        close(spoofer);
+        printf("%-28s %s\n", "tiny datagrams asking", check(!amplified, "no reply", "REPLY BIGGER THAN ASKED"));
+
+        // The counters are this client's own, other clients and pings don't show up in them
+        printf("%-28s %llu replies every >=%llums, acked=%u applied=%u last sent=%u, receiver lost=%u stale=%u received=%u (%s)\n",
+               "return channel", (unsigned long long)replies, (unsigned long long)config.reply_interval_ms,
+               lastReply.acked_seq, lastReply.applied_seq, nextSeq - 1, lastReply.lost, lastReply.stale, lastReply.received,
+               check(lastReply.received <= builtDatagrams, "own", "NOT OURS"));
+        printPercentiles("round trip (read at sends)", roundTrips);
+    }
+
+    if (sendV2)
+    {
+        // A datagram overtaken by a newer one must not be applied after it
+        u32 seq = nextSeq;
+        nextSeq += 2;
+        size = buildDatagram(datagram, 1, keys + 1, seq + 1);
+        sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        size = buildDatagram(datagram, 1, keys + 2, seq);
+        sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        svcSleepThread(50000000);
+        printf("%-28s %s\n", "reordered datagram", check(rec.lastButtons[1] == keys + 1, "dropped", "APPLIED"));
+
+        // Log settings changed over the network, then put back. Only the client playing may change them.
+        u32 infoCategories = log_enabled[LOG_INFO];
+        struct log_control control = {LOG_CONTROL_MAGIC, LOG_DEBUG, (u8)trace_enabled.load(), LOG_CAT_NET | LOG_CAT_HID};
+        int stranger = socket(AF_INET, SOCK_DGRAM, 0);
+        sendto(stranger, &control, sizeof(control), 0, (struct sockaddr*)&dest, sizeof(dest));
+        close(stranger);
+        svcSleepThread(50000000);
+        bool strangerIgnored = log_enabled[LOG_DEBUG] == 0;
+        sendto(client, &control, sizeof(control), 0, (struct sockaddr*)&dest, sizeof(dest));
+        svcSleepThread(50000000);
+        printf("%-28s %s, debug=0x%x trace=0x%x from the client (%s)\n", "log control packet",
+               check(strangerIgnored, "ignored from a stranger", "TAKEN FROM A STRANGER"), log_enabled[LOG_DEBUG].load(),
+               log_enabled[LOG_TRACE].load(), check(log_enabled[LOG_DEBUG] == (LOG_CAT_NET | LOG_CAT_HID), "taken", "IGNORED"));
+        log_configure(infoCategories != 0 ? LOG_INFO : LOG_WARN, infoCategories != 0 ? infoCategories : log_enabled[LOG_WARN].load());
+
+        // A tap that went down and up between two datagrams, only the edges know about it
+        const u64 tap = 0x1;
+        keys = (keys + 1) & ~tap;
+        rec.buttonsSeen[1] = 0;
+        size = buildDatagram(datagram, 1, keys, nextSeq++, 0, tap, tap);
+        sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        // Followed right away by a plain one, so draining can coalesce the two
+        size = buildDatagram(datagram, 1, keys, nextSeq++);
+        sendto(client, datagram, size, 0, (struct sockaddr*)&dest, sizeof(dest));
+        svcSleepThread((s64)(config.tap_hold_us + 50000) * 1000);
+        bool seen = (rec.buttonsSeen[1] & tap) != 0;
+        bool released = rec.lastButtons[1] == keys;
+        // A majority vote only goes by held buttons, a lone sender's taps don't make it through
+        if (config.anarchy && config.anarchy_buttons == ANARCHY_BUTTONS_MAJORITY)
+            printf("%-28s %s, %s\n", "tap between datagrams", check(!seen, "outvoted", "PRESSED"), check(released, "released", "STUCK"));
+        else
+            printf("%-28s %s, %s\n", "tap between datagrams", check(seen, "pressed", "MISSED"), check(released, "released", "STUCK"));
+
+        if (lossPercent > 0)
+            lossyTaps(client, &dest, keys, 100);
+        clientRestart(client, &dest, ++keys);
+        secondClient(client, &dest, keys);
+        if (!config.anarchy)
+            natPlayers(client, &dest, keys);
+        // Last, it takes every slot that's free
+        fullDatagrams(client, &dest, keys);
+        keys += INPUT_MAX_HISTORY + 2;
+    }
+    addressChange(client, &dest, keys);
+    keys++;
+    if (config.apply_mode == APPLY_MODE_BATCH && hosversionAtLeast(7, 0, 0))
+        failingStateList(client, &dest, keys);
+    queryStats(&dest);
+    clientSocket = -1;
+    close(client);
+}
+
+// Hammers TripleBuffer from a writer and a reader thread. Every frame is stamped with one counter in all
+// of its fields, so a frame the reader sees half-written or older than the one before shows up here.
+static void stressTripleBuffer(int durationMs)
+{
+    static TripleBuffer<struct input_frame> buffer;
+    std::atomic<bool> stop{false};
+    u64 published = 0, overwritten = 0;
+    u64 consumed = 0, torn = 0, backwards = 0;
+
+    std::thread writer([&] {
+        u32 seq = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            struct input_frame& frame = buffer.back();
+            seq++;
+            frame.info.seq = seq;
+            frame.message.con_count = MAX_CONTROLLERS;
+            for (int i = 0; i < MAX_CONTROLLERS; i++)
+            {
+                frame.message.controllers[i].keys = seq;
+                frame.message.controllers[i].joy_l_x = frame.message.controllers[i].joy_r_y = (s32)seq;
+            }
+            frame.info.send_time_us = seq;
+            if (buffer.publish())
+                overwritten++;
+            published++;
+        }
+    });
+
+    std::thread reader([&] {
+        u32 last = 0;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            if (!buffer.consume())
+                continue;
+            const struct input_frame& frame = buffer.front();
+            u32 seq = frame.info.seq;
+            bool whole = frame.info.send_time_us == seq;
+            for (int i = 0; i < MAX_CONTROLLERS; i++)
+            {
+                whole = whole && frame.message.controllers[i].keys == seq &&
+                        frame.message.controllers[i].joy_l_x == (s32)seq && frame.message.controllers[i].joy_r_y == (s32)seq;
+            }
+            if (!whole)
+                torn++;
+            if (seq <= last)
+                backwards++;
+            last = seq;
+            consumed++;
+        }
+    });
+
+    svcSleepThread((s64)durationMs * 1000000);
+    stop = true;
+    writer.join();
+    reader.join();
+
+    printf("%-28s published=%llu consumed=%llu overwritten unread=%llu\n", "triple buffer stress",
+           (unsigned long long)published, (unsigned long long)consumed, (unsigned long long)overwritten);
+    printf("%-28s torn=%llu backwards=%llu -> %s\n", "triple buffer consistency",
+           (unsigned long long)torn, (unsigned long long)backwards, check(torn == 0 && backwards == 0, "OK", "BROKEN"));
+}
+
+// Cost of a log line through the ring from two threads at once, against what printToFile used to do
+// for every line (open, write, close)
+static void benchLogger(int records)
+{
+    const char* textPath = "/tmp/hidplus-bench-log.txt";
+    const char* oldTextPath = "/tmp/hidplus-bench-log.txt.old";
+    const char* binaryPath = "/tmp/hidplus-bench-trace.bin";
+    remove(textPath);
+    remove(oldTextPath);
+    remove(binaryPath);
+    log_start(textPath, binaryPath);
+    const log_stats* stats = get_log_stats();
+
+    u64 start = svcGetSystemTick();
+    for (int i = 0; i < 200; i++)
+    {
+        FILE* file = fopen("/tmp/hidplus-bench-fopen.txt", "a");
+        fprintf(file, "Fatal Error while updating Controller State. %d\n", i);
+        fclose(file);
+    }
+    double fopenUs = ticksToUs(svcGetSystemTick() - start) / 200;
+    remove("/tmp/hidplus-bench-fopen.txt");
+
+    // Paced to roughly what the writer can keep up with, bursts beyond the ring's size get dropped
+    std::vector<u64> pushTicks[2];
+    auto producer = [&](int id) {
+        for (int i = 0; i < records; i++)
+        {
+            u64 before = svcGetSystemTick();
+            if (id == 0)
+                log_printf("Fatal Error while updating Controller State. %d", i);
+            else
+                log_binary(1, &before, sizeof(before));
+            pushTicks[id].push_back(svcGetSystemTick() - before);
+            if (i % 64 == 63)
+                svcSleepThread(60000000);
+        }
+    };
+    std::thread text(producer, 0), binary(producer, 1);
+    text.join();
+    binary.join();
+
+    u64 deadline = svcGetSystemTick() + armNsToTicks(2000000000);
+    while (stats->written < stats->pushed && svcGetSystemTick() < deadline)
+        svcSleepThread(10000000);
+
+    // Lines end up in the log file or, once it was rotated, the one before it
+    int lines = 0;
+    long textSize = 0;
+    for (const char* path : {oldTextPath, textPath})
+    {
+        FILE* file = fopen(path, "r");
+        for (int c; file != nullptr && (c = fgetc(file)) != EOF;)
+            lines += c == '\n';
+        if (file != nullptr)
+        {
+            textSize = ftell(file);
+            fclose(file);
+        }
+    }
+
+    // What a log line at a level that's turned off costs on the hot path
+    log_configure(LOG_INFO, LOG_CAT_ALL);
+    const int disabledCalls = 10000000;
+    start = svcGetSystemTick();
+    for (int i = 0; i < disabledCalls; i++)
+        LOG(LOG_TRACE, LOG_CAT_NET, "Datagram %d", i);
+    double disabledNs = armTicksToNs(svcGetSystemTick() - start) / (double)disabledCalls;
+
+    printf("%-28s %.1fus per line\n", "fopen/fprintf/fclose", fopenUs);
+    printf("%-28s %.2fns per call\n", "LOG at a disabled level", disabledNs);
+    printPercentiles("log_printf push", pushTicks[0]);
+    printPercentiles("log_binary push", pushTicks[1]);
+    printf("%-28s pushed=%llu dropped=%llu written=%llu, %d lines in the log file\n", "logger",
+           (unsigned long long)stats->pushed.load(), (unsigned long long)stats->dropped.load(),
+           (unsigned long long)stats->written.load(), lines);
+    printf("%-28s %ld bytes (cap %d) -> %s\n", "log file size", textSize, LOG_MAX_SIZE,
+           check(textSize < LOG_MAX_SIZE + LOG_MAX_PAYLOAD + 16, "capped", "TOO BIG"));
+}
+
+// anarchy_merge on its own, fed synthetic streams from a number of senders: every sender changes a few
+// buttons and its sticks each frame. Each result is checked against a plain per-button count first.
+static void benchAnarchy(int senders, int frames)
+{
+    static const char* const buttonNames[] = {"or", "majority", "last"};
+    static const char* const stickNames[] = {"average", "last"};
+    struct anarchy_senders input = {};
+    input.count = std::min(senders, ANARCHY_MAX_SENDERS);
+    srand(1);
+    for (u32 i = 0; i < input.count; i++)
+        input.keys[i] = ((u64)rand() << 32) | rand();
+
+    // The same frames for every policy
+    std::vector<struct anarchy_senders> stream(64, input);
+    for (size_t f = 0; f < stream.size(); f++)
+    {
+        for (u32 i = 0; i < input.count; i++)
+        {
+            stream[f].con_type[i] = 1;
+            stream[f].keys[i] = input.keys[i] ^ (1ull << (rand() % 64)) ^ (1ull << (rand() % 64));
+            for (int j = 0; j < 4; j++)
+                stream[f].joy[j][i] = rand() % 65536 - 32768;
+            stream[f].tick[i] = rand();
+        }
+    }
+
+    int wrong = 0;
+    for (const struct anarchy_senders& frame : stream)
+    {
+        u64 any = 0, most = 0;
+        for (int b = 0; b < 64; b++)
+        {
+            u32 held = 0;
+            for (u32 i = 0; i < frame.count; i++)
+                held += (frame.keys[i] >> b) & 1;
+            any |= (u64)(held > 0) << b;
+            most |= (u64)(held > frame.count / 2) << b;
+        }
+        u32 newest = 0;
+        for (u32 i = 1; i < frame.count; i++)
+            newest = frame.tick[i] > frame.tick[newest] ? i : newest;
+        s64 sum = 0;
+        for (u32 i = 0; i < frame.count; i++)
+            sum += frame.joy[0][i];
+
+        wrong += anarchy_or(frame.keys, frame.count) != any;
+        wrong += anarchy_majority(frame.keys, frame.count) != most;
+        wrong += anarchy_newest(frame.tick, frame.count) != newest;
+        wrong += anarchy_average(frame.joy[0], frame.count) != (s32)(sum / (s64)frame.count);
+    }
+    printf("%-28s %u senders, %zu frames, %d mismatches against the plain versions -> %s\n", "anarchy merge check", input.count,
+           stream.size(), wrong, check(wrong == 0, "OK", "WRONG"));
+
+    for (u64 buttons = ANARCHY_BUTTONS_OR; buttons <= ANARCHY_BUTTONS_LAST; buttons++)
+    {
+        for (u64 sticks = ANARCHY_STICKS_AVERAGE; sticks <= ANARCHY_STICKS_LAST; sticks++)
+        {
+            struct controller_record merged = {};
+            u64 checksum = 0;
+            u64 start = svcGetSystemTick();
+            for (int f = 0; f < frames; f++)
+            {
+                anarchy_merge(&stream[f % stream.size()], buttons, sticks, &merged);
+                checksum += merged.keys + merged.joy_l_x;
+            }
+            u64 elapsed = svcGetSystemTick() - start;
+            char name[32];
+            snprintf(name, sizeof(name), "anarchy %s/%s", buttonNames[buttons], stickNames[sticks]);
+            printf("%-28s %.1fns per merge (checksum %llx)\n", name, armTicksToNs(elapsed) / (double)frames,
+                   (unsigned long long)checksum);
+        }
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-n packets] [-a apply iterations] [-s send interval us] [-b burst] [-i ipc cost us] [-k keepalive ms] [-m single|batch] [-r polling|event|drain] [-p apply period us] [-f firmware major] [-j] [-t stress ms] [-2] [-H history frames] [-l loss percent] [-d keyframe interval] [-R] [-c sync pings] [-o client clock offset us] [-L log records] [-C config file] [-T trace file] [-A anarchy senders] [-v]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+    int packets = 500;
+    int applyIterations = 100000;
+    int sendIntervalUs = 1000;
+    int burst = 1;
+    int stressMs = 0;
+    int logRecords = 0;
+    int anarchySenders = 0;
+    const char* tracePath = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:a:s:b:i:k:m:r:p:f:jt:2H:l:d:Rc:o:L:C:T:A:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': packets = atoi(optarg); break;
+            case 'a': applyIterations = atoi(optarg); break;
+            case 's': sendIntervalUs = atoi(optarg); break;
+            case 'b': burst = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'i': host::hiddbgRecorder().ipcCostNs = (u64)atoi(optarg) * 1000; break;
+            case 'k': config.keepalive_ms = strtoull(optarg, nullptr, 0); break;
+            case 'm': config.apply_mode = strcmp(optarg, "single") == 0 ? APPLY_MODE_SINGLE : APPLY_MODE_BATCH; break;
+            case 'r':
+                if (strcmp(optarg, "polling") == 0)
+                    config.receive_mode = RECEIVE_MODE_POLLING;
+                else
+                    config.receive_mode = strcmp(optarg, "event") == 0 ? RECEIVE_MODE_EVENT : RECEIVE_MODE_DRAIN;
+                break;
+            case 'p': config.apply_period_us = strtoull(optarg, nullptr, 0); break;
+            case 'f': hosversionSet(MAKEHOSVERSION(atoi(optarg), 0, 0)); break;
+            case 'j': config.jitter_buffer = 1; break;
+            case 't': stressMs = atoi(optarg); break;
+            case '2': sendV2 = true; break;
+            case 'H': historyDepth = std::min(atoi(optarg), INPUT_MAX_HISTORY); break;
+            case 'l': lossPercent = atoi(optarg); break;
+            case 'd': keyframeInterval = atoi(optarg); wantReplies = true; break;
+            case 'R': wantReplies = true; break;
+            case 'c': syncPings = atoi(optarg); break;
+            case 'o': clientClockOffsetUs = strtoll(optarg, nullptr, 0); break;
+            case 'L': logRecords = atoi(optarg); break;
+            case 'T': tracePath = optarg; break;
+            case 'A': anarchySenders = atoi(optarg); break;
+            case 'C':
+                if (load_config(optarg) != 0)
+                    fprintf(stderr, "can't read %s\n", optarg);
+                log_configure(config.log_level, config.log_categories);
+                break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // The real logger, straight to the terminal, and the binary trace to -T's file
+    if (verbose)
+        log_configure(LOG_TRACE, LOG_CAT_ALL);
+    if (verbose || tracePath != nullptr)
+    {
+        if (tracePath != nullptr)
+            remove(tracePath);
+        trace_enabled = tracePath != nullptr;
+        log_start(verbose ? "/dev/stderr" : nullptr, tracePath);
+    }
+
+    if (logRecords > 0)
+    {
+        benchLogger(logRecords);
+        fflush(stdout);
+        _exit(failures != 0);
+    }
+
+    if (anarchySenders > 0)
+    {
+        benchAnarchy(anarchySenders, applyIterations * 100);
+        return failures != 0;
+    }
+
+    if (stressMs > 0)
+    {
+        stressTripleBuffer(stressMs);
+        return failures != 0;
+    }
+
+    benchApply(applyIterations);
+    benchNetwork(packets, sendIntervalUs, burst);
+
+    // The input threads never return, don't run static destructors underneath them
+    if (failures != 0)
+        printf("%d check(s) failed\n", failures);
+    fflush(stdout);
+    _exit(failures != 0);
+}
@@ -0,0 +1,218 @@
+#include "nx_host.hpp"
+#include <chrono>
+#include <thread>
+#include <unistd.h>
+
+static const std::chrono::steady_clock::time_point tickEpoch = std::chrono::steady_clock::now();
+
+u64 svcGetSystemTick(void)
+{
+    u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tickEpoch).count();
+    return armNsToTicks(ns);
+}
+
+void svcSleepThread(s64 nano)
+{
+    // 0 and the negative values are yields on the console
+    if (nano <= 0)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::nanoseconds(nano));
+}
+
+Result threadCreate(Thread* t, ThreadFunc entry, void* arg, void* stack_mem, size_t stack_sz, int prio, int cpuid)
+{
+    t->entry = entry;
+    t->arg = arg;
+    return 0;
+}
+
+Result threadStart(Thread* t)
+{
+    std::thread(t->entry, t->arg).detach();
+    return 0;
+}
+
+bool leventWait(LEvent* le, u64 timeout)
+{
+    std::unique_lock<std::mutex> lock(le->mutex);
+    if (timeout == UINT64_MAX)
+        le->cond.wait(lock, [le] { return le->signaled; });
+    else if (!le->cond.wait_for(lock, std::chrono::nanoseconds(timeout), [le] { return le->signaled; }))
+        return false;
+    if (le->autoclear)
+        le->signaled = false;
+    return true;
+}
+
+void leventSignal(LEvent* le)
+{
+    {
+        std::lock_guard<std::mutex> lock(le->mutex);
+        le->signaled = true;
+    }
+    le->cond.notify_all();
+}
+
+void leventClear(LEvent* le)
+{
+    std::lock_guard<std::mutex> lock(le->mutex);
+    le->signaled = false;
+}
+
+static std::atomic<u32> hosVersion{MAKEHOSVERSION(13, 2, 1)};
+
+u32 hosversionGet(void)
+{
+    return hosVersion;
+}
+
+void hosversionSet(u32 version)
+{
+    hosVersion = version;
+}
+
+static std::atomic<long> hostId{0x0100007f};
+
+long gethostid(void) noexcept
+{
+    return hostId;
+}
+
+void hostidSet(long id)
+{
+    hostId = id;
+}
+
+namespace host {
+    void HiddbgRecorder::reset()
+    {
+        attachCalls = 0;
+        detachCalls = 0;
+        setStateCalls = 0;
+        getStateListCalls = 0;
+        applyStateListCalls = 0;
+        failedCalls = 0;
+        for (int i = 0; i <= maxDevices; i++)
+        {
+            lastButtons[i] = 0;
+            lastSetTick[i] = 0;
+            attached[i] = false;
+            buttonsSeen[i] = 0;
+        }
+    }
+
+    HiddbgRecorder& hiddbgRecorder()
+    {
+        static HiddbgRecorder recorder;
+        return recorder;
+    }
+}
+
+static void simulateIpc()
+{
+    u64 cost = host::hiddbgRecorder().ipcCostNs;
+    if (cost == 0)
+        return;
+    u64 end = svcGetSystemTick() + armNsToTicks(cost);
+    while (svcGetSystemTick() < end) {}
+}
+
+// Same failure code libnx uses for a bad handle, the value itself doesn't matter here
+#define HOST_ERR_BAD_HANDLE 0xE401
+
+Result hiddbgAttachHdlsVirtualDevice(HiddbgHdlsHandle *handle, const HiddbgHdlsDeviceInfo *info)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    simulateIpc();
+    rec.attachCalls++;
+    for (int i = 1; i <= host::HiddbgRecorder::maxDevices; i++)
+    {
+        bool expected = false;
+        if (rec.attached[i].compare_exchange_strong(expected, true))
+        {
+            rec.devices[i] = *info;
+            handle->handle = i;
+            return 0;
+        }
+    }
+    rec.failedCalls++;
+    return HOST_ERR_BAD_HANDLE;
+}
+
+Result hiddbgDetachHdlsVirtualDevice(HiddbgHdlsHandle handle)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    simulateIpc();
+    rec.detachCalls++;
+    if (handle.handle == 0 || handle.handle > host::HiddbgRecorder::maxDevices || !rec.attached[handle.handle])
+    {
+        rec.failedCalls++;
+        return HOST_ERR_BAD_HANDLE;
+    }
+    rec.attached[handle.handle] = false;
+    return 0;
+}
+
+static Result recordState(HiddbgHdlsHandle handle, const HiddbgHdlsState *state)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    if (handle.handle == 0 || handle.handle > host::HiddbgRecorder::maxDevices || !rec.attached[handle.handle])
+    {
+        rec.failedCalls++;
+        return HOST_ERR_BAD_HANDLE;
+    }
+    rec.lastButtons[handle.handle] = state->buttons;
+    rec.buttonsSeen[handle.handle] |= state->buttons;
+    rec.lastSetTick[handle.handle] = svcGetSystemTick();
+    return 0;
+}
+
+Result hiddbgSetHdlsState(HiddbgHdlsHandle handle, const HiddbgHdlsState *state)
+{
+    simulateIpc();
+    host::hiddbgRecorder().setStateCalls++;
+    return recordState(handle, state);
+}
+
+Result hiddbgGetHdlsStateList(HiddbgHdlsSessionId session_id, HiddbgHdlsStateList *state_list)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    simulateIpc();
+    rec.getStateListCalls++;
+    if (hosversionBefore(7, 0, 0) || rec.failStateList)
+        return HOST_ERR_BAD_HANDLE;
+
+    state_list->total_entries = 0;
+    for (int i = 1; i <= host::HiddbgRecorder::maxDevices; i++)
+    {
+        if (!rec.attached[i])
+            continue;
+        HiddbgHdlsStateListEntry& entry = state_list->entries[state_list->total_entries++];
+        entry.handle.handle = i;
+        entry.device = rec.devices[i];
+        entry.state = {};
+        entry.state.buttons = rec.lastButtons[i];
+    }
+    return 0;
+}
+
+Result hiddbgApplyHdlsStateList(HiddbgHdlsSessionId session_id, const HiddbgHdlsStateList *state_list)
+{
+    host::HiddbgRecorder& rec = host::hiddbgRecorder();
+    simulateIpc();
+    rec.applyStateListCalls++;
+    if (hosversionBefore(7, 0, 0) || rec.failStateList)
+        return HOST_ERR_BAD_HANDLE;
+
+    Result result = 0;
+    for (s32 i = 0; i < state_list->total_entries; i++)
+    {
+        Result entryResult = recordState(state_list->entries[i].handle, &state_list->entries[i].state);
+        if (R_FAILED(entryResult))
+            result = entryResult;
+    }
+    return result;
+}
@@ -0,0 +1,92 @@
+// Turns a /hidplus/trace.bin into Chrome trace JSON, for chrome://tracing or ui.perfetto.dev:
+//
+//   hidplus-trace2json trace.bin > trace.json
+//
+// The file is what the logger writes for binary records, log_record_header + payload back to back.
+
+#include "logger.hpp"
+#include "trace.hpp"
+#include <stdio.h>
+#include <string.h>
+
+struct event_format
+{
+    const char* name;
+    int tid; // Which thread emits it
+    const char* a;
+    const char* b;
+};
+
+static const event_format formats[TRACE_EVENT_COUNT] = {
+    {nullptr, 0, nullptr, nullptr},
+    {"receive", 1, "seq", "datagrams"},
+    {"handoff", 1, "seq", "replaced_unread"},
+    {"link", 1, "up", nullptr},
+    {"apply", 2, "seq", "dirty_mask"},
+    {"hid call", 2, "controllers", "result"},
+    {"attach", 2, "device_type", "result"},
+    {"detach", 2, "handle", "result"},
+};
+
+static double ticksToUs(u64 ticks)
+{
+    return ticks * 1e6 / armGetSystemTickFreq();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s trace.bin > trace.json\n", argv[0]);
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if (file == nullptr)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    printf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"network\"}},\n");
+    printf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"apply\"}}");
+
+    struct log_record_header header;
+    u64 events = 0, skipped = 0;
+    while (fread(&header, sizeof(header), 1, file) == 1)
+    {
+        u8 payloadData[LOG_MAX_PAYLOAD];
+        if (header.length > sizeof(payloadData) || fread(payloadData, 1, header.length, file) != header.length)
+            break;
+
+        // Records this converter doesn't know about are kept out of the JSON, not treated as corruption
+        if (header.kind == LOG_KIND_TEXT || header.kind >= TRACE_EVENT_COUNT || header.length != sizeof(struct trace_payload))
+        {
+            skipped++;
+            continue;
+        }
+        struct trace_payload payload;
+        memcpy(&payload, payloadData, sizeof(payload));
+        const event_format& format = formats[header.kind];
+
+        printf(",\n{\"name\": \"%s\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, ", format.name, format.tid,
+               ticksToUs(payload.begin_tick != 0 ? payload.begin_tick : header.tick));
+        if (payload.begin_tick != 0)
+            printf("\"ph\": \"X\", \"dur\": %.3f, ", ticksToUs(header.tick - payload.begin_tick));
+        else
+            printf("\"ph\": \"i\", \"s\": \"t\", ");
+        printf("\"args\": {\"%s\": %u", format.a, payload.a);
+        if (format.b != nullptr)
+            printf(", \"%s\": %u", format.b, payload.b);
+        printf("}}");
+        events++;
+    }
+    printf("\n]}\n");
+
+    fprintf(stderr, "%llu events", (unsigned long long)events);
+    if (skipped > 0)
+        fprintf(stderr, ", %llu unknown records skipped", (unsigned long long)skipped);
+    fprintf(stderr, "\n");
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "anarchy.hpp"
+
+// Enough bits to count up to ANARCHY_MAX_SENDERS
+#define COUNT_BITS 7
+static_assert(ANARCHY_MAX_SENDERS < (1 << COUNT_BITS), "anarchy counters are too narrow");
+
+u64 anarchy_or(const u64* keys, u32 count)
+{
+    u64 merged = 0;
+    for (u32 i = 0; i < count; i++)
+        merged |= keys[i];
+    return merged;
+}
+
+// Counts every button at once: plane b holds bit b of each button's count, and adding a sender is a
+// ripple-carry add of its keys into the planes. The count is then compared against half the senders
+// the same way, from the top bit down.
+u64 anarchy_majority(const u64* keys, u32 count)
+{
+    u64 planes[COUNT_BITS] = {0};
+    for (u32 i = 0; i < count; i++)
+    {
+        u64 carry = keys[i];
+        for (u32 b = 0; b < COUNT_BITS; b++)
+        {
+            u64 next = planes[b] & carry;
+            planes[b] ^= carry;
+            carry = next;
+        }
+    }
+
+    u32 half = count / 2;
+    u64 greater = 0;
+    u64 equal = ~0ull;
+    for (s32 b = COUNT_BITS - 1; b >= 0; b--)
+    {
+        u64 bit = 0ull - ((half >> b) & 1);
+        greater |= equal & planes[b] & ~bit;
+        equal &= ~(planes[b] ^ bit);
+    }
+    return greater;
+}
+
+// Index of the newest tick, the first one on a tie
+u32 anarchy_newest(const u64* ticks, u32 count)
+{
+    u32 newest = 0;
+    u64 newestTick = ticks[0];
+    for (u32 i = 1; i < count; i++)
+    {
+        u64 newer = 0ull - (u64)(ticks[i] > newestTick);
+        newest = (u32)((newest & ~newer) | (i & newer));
+        newestTick = (newestTick & ~newer) | (ticks[i] & newer);
+    }
+    return newest;
+}
+
+s32 anarchy_average(const s32* values, u32 count)
+{
+    s64 sum = 0;
+    for (u32 i = 0; i < count; i++)
+        sum += values[i];
+    return (s32)(sum / (s64)count);
+}
+
+void anarchy_merge(const struct anarchy_senders* senders, u64 buttonPolicy, u64 stickPolicy, struct controller_record* out)
+{
+    u32 count = senders->count;
+    if (count == 0)
+        return;
+
+    u32 newest = anarchy_newest(senders->tick, count);
+    out->con_type = senders->con_type[newest];
+
+    switch (buttonPolicy)
+    {
+        case ANARCHY_BUTTONS_MAJORITY:
+            out->keys = anarchy_majority(senders->keys, count);
+            break;
+        case ANARCHY_BUTTONS_LAST:
+            out->keys = senders->keys[newest];
+            break;
+        default:
+            out->keys = anarchy_or(senders->keys, count);
+            break;
+    }
+
+    s32 joy[4];
+    for (int j = 0; j < 4; j++)
+        joy[j] = stickPolicy == ANARCHY_STICKS_LAST ? senders->joy[j][newest] : anarchy_average(senders->joy[j], count);
+    out->joy_l_x = joy[0];
+    out->joy_l_y = joy[1];
+    out->joy_r_x = joy[2];
+    out->joy_r_y = joy[3];
+}
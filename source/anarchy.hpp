@@ -0,0 +1,39 @@
+#pragma once
+#include "platform.hpp"
+#include "udp_manager.hpp"
+
+// Anarchy mode: every client plays the same controller. The first controller of each client that's
+// still sending is merged into one record, buttons and sticks each with their own policy. Everything
+// here is straight-line bit arithmetic so it stays cheap with dozens of senders.
+enum anarchy_buttons
+{
+    ANARCHY_BUTTONS_OR,       // Held if anyone holds it
+    ANARCHY_BUTTONS_MAJORITY, // Held if more than half of the senders hold it
+    ANARCHY_BUTTONS_LAST,     // Whatever the sender with the newest input holds
+};
+
+enum anarchy_sticks
+{
+    ANARCHY_STICKS_AVERAGE,
+    ANARCHY_STICKS_LAST,
+};
+
+#define ANARCHY_MAX_SENDERS 64
+
+// One entry per sender, laid out by field so each merge walks one array
+struct anarchy_senders
+{
+    u32 count;
+    u16 con_type[ANARCHY_MAX_SENDERS];
+    u64 keys[ANARCHY_MAX_SENDERS];
+    s32 joy[4][ANARCHY_MAX_SENDERS]; // joy_l_x, joy_l_y, joy_r_x, joy_r_y
+    u64 tick[ANARCHY_MAX_SENDERS];   // When its input arrived, for the last-writer policies
+};
+
+u64 anarchy_or(const u64* keys, u32 count);
+u64 anarchy_majority(const u64* keys, u32 count);
+u32 anarchy_newest(const u64* ticks, u32 count);
+s32 anarchy_average(const s32* values, u32 count);
+
+// Merges senders into out, which is left alone if there are none. con_type is the newest sender's.
+void anarchy_merge(const struct anarchy_senders* senders, u64 buttonPolicy, u64 stickPolicy, struct controller_record* out);
@@ -0,0 +1,214 @@
+#include "clock_sync.hpp"
+#include "con_manager.hpp"
+#include "config.hpp"
+#include <algorithm>
+
+// Pongs we're waiting to hear back about, and how many of the last exchanges the offset is picked from
+#define PENDING_PINGS 4
+#define OFFSET_SAMPLES 8
+
+// Clients whose clocks are tracked at once. The one that pinged longest ago makes room for a new one, but
+// only once it's been quiet for session_timeout_ms, so a burst of pings from new addresses can't wipe
+// the offsets of clients that are still playing.
+#define CLOCK_PEERS 8
+
+bool LatencyWindow::record(u32 us)
+{
+    samples[next] = us;
+    next = (next + 1) % size;
+    if (filled < size)
+        filled++;
+    count++;
+    if (count % updateEvery != 0)
+        return false;
+
+    u32 sorted[size];
+    memcpy(sorted, samples, filled * sizeof(u32));
+    auto pct = [&](u32 p) {
+        u32* nth = sorted + (filled - 1) * p / 100;
+        std::nth_element(sorted, nth, sorted + filled);
+        return *nth;
+    };
+    p50 = pct(50);
+    p90 = pct(90);
+    p99 = pct(99);
+    return true;
+}
+
+static struct latency_stats latencyStats;
+
+// Network thread only
+struct pending_ping
+{
+    u32 id;
+    u64 t1;
+    u64 t2;
+    u64 t3;
+};
+
+struct offset_sample
+{
+    s64 offset;
+    u64 delay;
+};
+
+struct clock_peer
+{
+    u32 ip; // 0 if unused
+    u64 lastPingTick;
+    pending_ping pendingPings[PENDING_PINGS];
+    offset_sample offsetSamples[OFFSET_SAMPLES];
+    u32 offsetSampleCount;
+    s64 offset;
+    bool offsetKnown;
+};
+
+static clock_peer clockPeers[CLOCK_PEERS];
+
+// Only the apply thread writes it, for the periodic report
+static bool lastOffsetKnown = false;
+
+static clock_peer* find_peer(u32 ip)
+{
+    for (clock_peer& peer : clockPeers)
+    {
+        if (peer.ip == ip)
+            return &peer;
+    }
+    return nullptr;
+}
+
+static clock_peer* claim_peer(u32 ip, u64 now)
+{
+    clock_peer* peer = find_peer(ip);
+    if (peer != nullptr)
+        return peer;
+
+    peer = &clockPeers[0];
+    for (clock_peer& candidate : clockPeers)
+    {
+        if (candidate.ip == 0 || candidate.lastPingTick < peer->lastPingTick)
+            peer = &candidate;
+        if (candidate.ip == 0)
+            break;
+    }
+    if (peer->ip != 0 && now - peer->lastPingTick < armNsToTicks(config.session_timeout_ms * 1000000))
+        return nullptr;
+    memset(peer, 0, sizeof(*peer));
+    peer->ip = ip;
+    peer->lastPingTick = now;
+    return peer;
+}
+
+static u64 ticksToUs(u64 ticks)
+{
+    return armTicksToNs(ticks) / 1000;
+}
+
+// The exchange with the smallest round trip had the least queueing on the way, so its offset is the
+// one to trust (the NTP clock filter, more or less)
+static void add_offset_sample(clock_peer* peer, const pending_ping& sent, u64 t4)
+{
+    s64 offset = ((s64)(sent.t2 - sent.t1) + (s64)(sent.t3 - t4)) / 2;
+    s64 delay = (s64)(t4 - sent.t1) - (s64)(sent.t3 - sent.t2);
+    if (delay < 0)
+        return;
+
+    peer->offsetSamples[peer->offsetSampleCount % OFFSET_SAMPLES] = {offset, (u64)delay};
+    peer->offsetSampleCount++;
+
+    u32 filled = peer->offsetSampleCount < OFFSET_SAMPLES ? peer->offsetSampleCount : OFFSET_SAMPLES;
+    const offset_sample* best = &peer->offsetSamples[0];
+    for (u32 i = 1; i < filled; i++)
+    {
+        if (peer->offsetSamples[i].delay < best->delay)
+            best = &peer->offsetSamples[i];
+    }
+    peer->offset = best->offset;
+    peer->offsetKnown = true;
+}
+
+void clock_sync_pong(const struct time_ping* ping, u32 ip, u64 recvTick, struct time_pong* pong)
+{
+    clock_peer* peer = claim_peer(ip, recvTick);
+    if (peer != nullptr)
+        peer->lastPingTick = recvTick;
+    if (peer != nullptr && ping->prev_id != 0)
+    {
+        for (pending_ping& sent : peer->pendingPings)
+        {
+            if (sent.id == ping->prev_id)
+            {
+                add_offset_sample(peer, sent, ping->prev_recv_time_us);
+                sent.id = 0;
+            }
+        }
+    }
+
+    memset(pong, 0, sizeof(*pong));
+    pong->magic = TIME_PONG_MAGIC;
+    pong->id = ping->id;
+    pong->ping_send_time_us = ping->send_time_us;
+    pong->recv_time_us = ticksToUs(recvTick);
+    // No room to track this one, it still gets its timestamps but no offset
+    pong->offset_us = peer != nullptr ? peer->offset : 0;
+    pong->offset_known = peer != nullptr && peer->offsetKnown;
+    pong->network_p50_us = latencyStats.network.p50;
+    pong->network_p99_us = latencyStats.network.p99;
+    pong->queue_p50_us = latencyStats.queue.p50;
+    pong->queue_p99_us = latencyStats.queue.p99;
+    pong->total_p50_us = latencyStats.total.p50;
+    pong->total_p99_us = latencyStats.total.p99;
+
+    // Our send time is as close to the sendto as we can get it, the caller does nothing else in between
+    pong->send_time_us = ticksToUs(svcGetSystemTick());
+    if (peer == nullptr)
+        return;
+    pending_ping& slot = peer->pendingPings[ping->id % PENDING_PINGS];
+    slot = {ping->id, ping->send_time_us, pong->recv_time_us, pong->send_time_us};
+}
+
+void record_input_latency(const struct input_info* info, u64 doneTick)
+{
+    static u64 lastReport = 0;
+    if (info->recv_tick == 0 || doneTick < info->recv_tick)
+        return;
+
+    u32 queue = ticksToUs(doneTick - info->recv_tick);
+    bool updated = latencyStats.queue.record(queue);
+
+    lastOffsetKnown = info->clock_offset_known;
+    if (info->clock_offset_known)
+    {
+        // Our clock at the moment the client sent it
+        s64 sent = (s64)info->send_time_us + info->clock_offset_us;
+        s64 network = (s64)ticksToUs(info->recv_tick) - sent;
+        if (network < 0)
+            network = 0;
+        latencyStats.network.record((u32)network);
+        latencyStats.total.record((u32)network + queue);
+    }
+
+    if (updated && doneTick - lastReport >= armGetSystemTickFreq() * LOG_REPORT_SECONDS)
+    {
+        LOG(LOG_INFO, LOG_CAT_STATS, "Input latency p50/p99: network %u/%uus, queue %u/%uus, total %u/%uus (offset %s)",
+            latencyStats.network.p50.load(), latencyStats.network.p99.load(), latencyStats.queue.p50.load(),
+            latencyStats.queue.p99.load(), latencyStats.total.p50.load(), latencyStats.total.p99.load(),
+            lastOffsetKnown ? "synced" : "unknown");
+        lastReport = doneTick;
+    }
+}
+
+bool clock_offset_of(u32 ip, s64* offsetUs)
+{
+    const clock_peer* peer = find_peer(ip);
+    if (peer == nullptr || !peer->offsetKnown)
+        return false;
+    *offsetUs = peer->offset;
+    return true;
+}
+
+const latency_stats* get_latency_stats()
+{
+    return &latencyStats;
+}
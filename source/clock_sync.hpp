@@ -0,0 +1,48 @@
+#pragma once
+#include "platform.hpp"
+#include "udp_manager.hpp"
+#include <atomic>
+
+// The last few hundred values of one delay, with percentiles that are recomputed every so often by
+// the thread recording them so any thread can read them
+class LatencyWindow
+{
+public:
+    // Returns true when the percentiles were just recomputed
+    bool record(u32 us);
+
+    std::atomic<u32> p50{0};
+    std::atomic<u32> p90{0};
+    std::atomic<u32> p99{0};
+    std::atomic<u64> count{0};
+
+private:
+    static const u32 size = 256;
+    static const u32 updateEvery = 32;
+
+    u32 samples[size];
+    u32 filled = 0;
+    u32 next = 0;
+};
+
+struct latency_stats
+{
+    LatencyWindow network; // Client send -> recvfrom, only once the clock offset is known
+    LatencyWindow queue;   // recvfrom -> done handing the frame to HID, including any jitter buffer delay
+    LatencyWindow total;   // Both, only once the clock offset is known
+};
+
+// Every client has a clock of its own, so the offset is worked out per client IP. Pings come from
+// another port than the client's input, the IP is what they have in common.
+
+// Network thread: answers a time_ping from ip that arrived at recvTick, sets every field of pong but
+// send_time_us
+void clock_sync_pong(const struct time_ping* ping, u32 ip, u64 recvTick, struct time_pong* pong);
+
+// Network thread: our clock minus the client's, false if ip's offset isn't known (yet)
+bool clock_offset_of(u32 ip, s64* offsetUs);
+
+// Apply thread: a frame just went to HID at doneTick
+void record_input_latency(const struct input_info* info, u64 doneTick);
+
+const latency_stats* get_latency_stats();
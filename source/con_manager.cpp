@@ -1,14 +1,57 @@
 #include "con_manager.hpp"
 #include "udp_manager.hpp"
+#include "config.hpp"
+#include "triple_buffer.hpp"
+#include "jitter_buffer.hpp"
+#include "clock_sync.hpp"
+#include "stage_histograms.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
 #include <mutex>
 #include <array>
+#include <atomic>
 
 // Some of the code comes from hid-mitm
 
+HiddbgHdlsSessionId hdlsSessionId;
+
+// Counts a failed hiddbg call, the caller still decides what to say about it
+static void count_ipc_failure(Result result)
+{
+    metric_add(METRIC_IPC_FAILURES);
+    metric_set(METRIC_LAST_IPC_ERROR, result);
+}
+
+// Cached copy of HID's state list for APPLY_MODE_BATCH, it has to be fetched again whenever one of our
+// devices is attached or detached
+static HiddbgHdlsStateList hdlsStateList;
+static bool hdlsStateListValid = false;
+// After this many list calls failed in a row every controller is updated on its own for good
+#define STATE_LIST_MAX_FAILURES 3
+static u32 hdlsStateListFailures = 0;
+static bool hdlsStateListBroken = false;
+
+// The list is fetched again before the next try, whatever went wrong may have been about it
+static void state_list_failed(Result result)
+{
+    count_ipc_failure(result);
+    hdlsStateListValid = false;
+    hdlsStateListFailures++;
+    if (hdlsStateListFailures < STATE_LIST_MAX_FAILURES)
+    {
+        LOG(LOG_WARN, LOG_CAT_HID, "HDLS state list failed (0x%x), fetching it again.", result);
+        return;
+    }
+    LOG(LOG_WARN, LOG_CAT_HID, "HDLS state list failed (0x%x) %u times in a row, updating controllers one by one from now on.",
+        result, hdlsStateListFailures);
+    hdlsStateListBroken = true;
+}
+
 int FakeController::initialize(u16 conDeviceType)
 {
     if (isInitialized) return 0;
     Result myResult;
+    u64 traceBegin = svcGetSystemTick();
     //printToFile("Controller initializing...");
 
     // Set the controller type to Pro-Controller, and set the npadInterfaceType.
@@ -57,13 +100,18 @@ int FakeController::initialize(u16 conDeviceType)
     }
     
     myResult = hiddbgAttachHdlsVirtualDevice(&controllerHandle, &controllerDevice);
+    TRACE(TRACE_ATTACH, traceBegin, conDeviceType, myResult);
     if (R_FAILED(myResult)) {
-        printToFile("Failed connecting controller... fuck");
+        count_ipc_failure(myResult);
+        LOG(LOG_ERROR, LOG_CAT_HID, "Failed connecting controller... fuck");
         return -1;
     }
 
-    printToFile("Controller initialized!");
+    LOG(LOG_INFO, LOG_CAT_HID, "Controller initialized!");
+    metric_add(METRIC_ATTACHES);
+    metric_add(METRIC_CONTROLLERS);
     isInitialized = true;
+    hdlsStateListValid = false;
     return 0;
 }
 
@@ -71,106 +119,221 @@ int FakeController::deInitialize()
 {
     if (!isInitialized) return 0;
     Result myResult;
+    u64 traceBegin = svcGetSystemTick();
 
     controllerState = {0};
     hiddbgSetHdlsState(controllerHandle, &controllerState);
     
     myResult = hiddbgDetachHdlsVirtualDevice(controllerHandle);
+    TRACE(TRACE_DETACH, traceBegin, (u32)controllerHandle.handle, myResult);
     if (R_FAILED(myResult)) {
-        printToFile("Fatal Error while detaching controller.");
+        count_ipc_failure(myResult);
+        LOG(LOG_ERROR, LOG_CAT_HID, "Fatal Error while detaching controller.");
     }
+    metric_add(METRIC_DETACHES);
+    metric_set(METRIC_CONTROLLERS, metric_get(METRIC_CONTROLLERS) - 1);
     controllerHandle = {0};
     controllerDevice = {0};
 
     isInitialized = false;
+    hasSentState = false;
+    hdlsStateListValid = false;
+    baseButtons = heldPresses = heldReleases = 0;
+    latchUntil = 0;
 
     return 0;
 }
 
-std::array<FakeController, 8> fakeControllerList;
+bool FakeController::needsUpdate(u64 now, u64 keepAliveTicks)
+{
+    if (!hasSentState)
+        return true;
+    if (controllerState.buttons != sentState.buttons ||
+        controllerState.analog_stick_l.x != sentState.analog_stick_l.x || controllerState.analog_stick_l.y != sentState.analog_stick_l.y ||
+        controllerState.analog_stick_r.x != sentState.analog_stick_r.x || controllerState.analog_stick_r.y != sentState.analog_stick_r.y)
+        return true;
+    return keepAliveTicks != 0 && now - sentTick >= keepAliveTicks;
+}
+
+void FakeController::markSent(u64 now)
+{
+    sentState = controllerState;
+    sentTick = now;
+    hasSentState = true;
+}
+
+void FakeController::setButtons(u64 keys, u64 pressed, u64 released, u64 now, u64 holdTicks)
+{
+    if (now >= latchUntil)
+        heldPresses = heldReleases = 0;
+
+    // Went down and back up since the last frame, or up and back down
+    u64 taps = pressed & ~keys;
+    u64 represses = released & keys;
+    if (taps | represses)
+        latchUntil = now + holdTicks;
+    heldPresses = (heldPresses | taps) & ~represses;
+    heldReleases = (heldReleases | represses) & ~taps;
+
+    baseButtons = keys;
+    controllerState.buttons = (keys | heldPresses) & ~heldReleases;
+}
+
+// Returns true if letting go of the held buttons changed the state
+bool FakeController::expireLatches(u64 now)
+{
+    if ((heldPresses | heldReleases) == 0 || now < latchUntil)
+        return false;
+    heldPresses = heldReleases = 0;
+    controllerState.buttons = baseButtons;
+    return true;
+}
+
+void FakeController::neutralise()
+{
+    baseButtons = heldPresses = heldReleases = 0;
+    controllerState.buttons = 0;
+    controllerState.analog_stick_l = {0};
+    controllerState.analog_stick_r = {0};
+}
+
+std::array<FakeController, MAX_CONTROLLERS> fakeControllerList;
 u64 buttonPresses;
 
-void apply_fake_con_state(struct input_message message)
+static void apply_single_state(s32 i, u64 now)
 {
+    Result myResult;
+    // This function is causing all the issues in 12.0
+    u64 traceBegin = svcGetSystemTick();
+    myResult = hiddbgSetHdlsState(fakeControllerList[i].controllerHandle, &fakeControllerList[i].controllerState);
+    TRACE(TRACE_HID_CALL, traceBegin, 1 << i, myResult);
+    if (R_FAILED(myResult)) {
+        count_ipc_failure(myResult);
+        LOG(LOG_ERROR, LOG_CAT_HID, "Fatal Error while updating Controller State.");
+    }
+    else
+    {
+        fakeControllerList[i].markSent(now);
+        metric_add(METRIC_SLOT_UPDATES + i);
+    }
+}
+
+// Hands every controller to HID with a single hiddbgApplyHdlsStateList, returns the dirty ones it couldn't cover.
+// Only our own entries are sent, the others may belong to someone else and what we last read of them is stale.
+static u32 apply_state_list(u32 dirtyMask, u64 now)
+{
+    if (!hdlsStateListValid)
+    {
+        Result result = hiddbgGetHdlsStateList(hdlsSessionId, &hdlsStateList);
+        if (R_FAILED(result))
+        {
+            state_list_failed(result);
+            return dirtyMask;
+        }
+        hdlsStateListValid = true;
+    }
+
+    static HiddbgHdlsStateList ownStateList;
+    ownStateList.total_entries = 0;
+    u32 listedMask = 0;
+    for (s32 e = 0; e < hdlsStateList.total_entries; e++)
+    {
+        const HiddbgHdlsStateListEntry& entry = hdlsStateList.entries[e];
+        for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+        {
+            if (fakeControllerList[i].isInitialized && fakeControllerList[i].controllerHandle.handle == entry.handle.handle)
+            {
+                HiddbgHdlsStateListEntry& own = ownStateList.entries[ownStateList.total_entries++];
+                own = entry;
+                own.state = fakeControllerList[i].controllerState;
+                listedMask |= 1 << i;
+                break;
+            }
+        }
+    }
+
+    if ((dirtyMask & listedMask) == 0)
+        return dirtyMask;
+
+    u64 traceBegin = svcGetSystemTick();
+    Result result = hiddbgApplyHdlsStateList(hdlsSessionId, &ownStateList);
+    TRACE(TRACE_HID_CALL, traceBegin, listedMask, result);
+    if (R_FAILED(result))
+    {
+        state_list_failed(result);
+        return dirtyMask;
+    }
+    hdlsStateListFailures = 0;
+
+    for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        if (listedMask & (1 << i))
+        {
+            fakeControllerList[i].markSent(now);
+            metric_add(METRIC_SLOT_UPDATES + i);
+        }
+    }
+    return dirtyMask & ~listedMask;
+}
+
+static void push_dirty_states(u32 dirtyMask, u64 now)
+{
+    if (dirtyMask == 0)
+        return;
+
+    if (config.apply_mode == APPLY_MODE_BATCH && !hdlsStateListBroken && hosversionAtLeast(7, 0, 0))
+        dirtyMask = apply_state_list(dirtyMask, now);
+
+    for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        if (dirtyMask & (1 << i))
+            apply_single_state(i, now);
+    }
+}
+
+static std::atomic<u32> appliedSeq[MAX_CONTROLLERS];
+
+u32 get_applied_seq(u32 slot)
+{
+    return appliedSeq[slot].load(std::memory_order_relaxed);
+}
+
+void apply_fake_con_state(const struct input_frame* frame)
+{
+    const struct input_message* message = &frame->message;
+
     // Check if the magic is correct
-    if(message.magic != INPUT_MSG_MAGIC)
+    if(message->magic != INPUT_MSG_MAGIC)
         return;
 
-    u16 conType;
-    u64 keys;
-    s32 joylx;
-    s32 joyly;
-    s32 joyrx;
-    s32 joyry;
+    u64 now = svcGetSystemTick();
+    u64 keepAliveTicks = armNsToTicks(config.keepalive_ms * 1000000);
+    u64 holdTicks = armNsToTicks(config.tap_hold_us * 1000);
+    u32 dirtyMask = 0;
 
-    for(s32 i = 0; i < message.con_count; i++)
+    for(s32 i = 0; i < message->con_count; i++)
     {
-        switch(i)
+        const struct controller_record& record = message->controllers[i];
+        u16 conType = record.con_type;
+
+        // A timed out controller stays neutral (or detached) until its slot gets new input, other
+        // clients' frames still carry its last record
+        if (frame->slot_tick[i] != fakeControllerList[i].inputTick)
         {
-            case 0:
-                conType = message.con_type;
-                keys = message.keys;
-                joylx = message.joy_l_x;
-                joyly = message.joy_l_y;
-                joyrx = message.joy_r_x;
-                joyry = message.joy_r_y;
-                break;
-            case 1:
-                conType = message.con_type2;
-                keys = message.keys2;
-                joylx = message.joy_l_x2;
-                joyly = message.joy_l_y2;
-                joyrx = message.joy_r_x2;
-                joyry = message.joy_r_y2;
-                break;
-            case 2:
-                conType = message.con_type3;
-                keys = message.keys3;
-                joylx = message.joy_l_x3;
-                joyly = message.joy_l_y3;
-                joyrx = message.joy_r_x3;
-                joyry = message.joy_r_y3;
-                break;
-            case 3:
-                conType = message.con_type4;
-                keys = message.keys4;
-                joylx = message.joy_l_x4;
-                joyly = message.joy_l_y4;
-                joyrx = message.joy_r_x4;
-                joyry = message.joy_r_y4;
-                break;
-            case 4:
-                conType = message.con_type5;
-                keys = message.keys5;
-                joylx = message.joy_l_x5;
-                joyly = message.joy_l_y5;
-                joyrx = message.joy_r_x5;
-                joyry = message.joy_r_y5;
-                break;
-            case 5:
-                conType = message.con_type6;
-                keys = message.keys6;
-                joylx = message.joy_l_x6;
-                joyly = message.joy_l_y6;
-                joyrx = message.joy_r_x6;
-                joyry = message.joy_r_y6;
-                break;
-            case 6:
-                conType = message.con_type7;
-                keys = message.keys7;
-                joylx = message.joy_l_x7;
-                joyly = message.joy_l_y7;
-                joyrx = message.joy_r_x7;
-                joyry = message.joy_r_y7;
-                break;
-            case 7:
-                conType = message.con_type8;
-                keys = message.keys8;
-                joylx = message.joy_l_x8;
-                joyly = message.joy_l_y8;
-                joyrx = message.joy_r_x8;
-                joyry = message.joy_r_y8;
-                break;
+            fakeControllerList[i].inputTick = frame->slot_tick[i];
+            fakeControllerList[i].idle = false;
+        }
+        else if (fakeControllerList[i].idle)
+        {
+            continue;
+        }
+
+        // The slot went to another client: unplug the old controller first, so the new player gets a
+        // device of their own instead of its type and latched taps
+        if (frame->slot_owner_gen[i] != fakeControllerList[i].ownerGen)
+        {
+            fakeControllerList[i].ownerGen = frame->slot_owner_gen[i];
+            fakeControllerList[i].deInitialize();
         }
 
         // If there is no controller connected, we have to initialize one
@@ -188,47 +351,277 @@ void apply_fake_con_state(struct input_message message)
 
         if (fakeControllerList[i].isInitialized)
         {
-            fakeControllerList[i].controllerState.buttons = keys;
-            fakeControllerList[i].controllerState.analog_stick_l.x = joylx;
-            fakeControllerList[i].controllerState.analog_stick_l.y = joyly;
-            fakeControllerList[i].controllerState.analog_stick_r.x = joyrx;
-            fakeControllerList[i].controllerState.analog_stick_r.y = joyry;
-            Result myResult;
-            // This function is causing all the issues in 12.0
-            myResult = hiddbgSetHdlsState(fakeControllerList[i].controllerHandle, &fakeControllerList[i].controllerState);
-            if (R_FAILED(myResult)) {
-                printToFile("Fatal Error while updating Controller State.");
-            }   
+            fakeControllerList[i].setButtons(record.keys, frame->pressed[i], frame->released[i], now, holdTicks);
+            fakeControllerList[i].controllerState.analog_stick_l.x = record.joy_l_x;
+            fakeControllerList[i].controllerState.analog_stick_l.y = record.joy_l_y;
+            fakeControllerList[i].controllerState.analog_stick_r.x = record.joy_r_x;
+            fakeControllerList[i].controllerState.analog_stick_r.y = record.joy_r_y;
+            if (fakeControllerList[i].needsUpdate(now, keepAliveTicks))
+                dirtyMask |= 1 << i;
         }
     }
+
+    push_dirty_states(dirtyMask, now);
+    u64 done = svcGetSystemTick();
+    TRACE(TRACE_APPLY, now, frame->info.seq, dirtyMask);
+    record_input_latency(&frame->info, done);
+    record_apply_stages(&frame->info, now, done);
+    for (s32 i = 0; i < message->con_count; i++)
+        appliedSeq[i].store(frame->slot_seq[i], std::memory_order_relaxed);
     
     return;
 }
 
-static Mutex pkgMutex;
-static struct input_message fakeConsState;
+// Releases latched taps whose hold time is up, returns the tick the next one is due (0 if none are held)
+u64 expire_button_latches()
+{
+    u64 now = svcGetSystemTick();
+    u64 keepAliveTicks = armNsToTicks(config.keepalive_ms * 1000000);
+    u64 nextDue = 0;
+    u32 dirtyMask = 0;
+
+    for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        FakeController& controller = fakeControllerList[i];
+        if (!controller.isInitialized)
+            continue;
+        if (controller.expireLatches(now) && controller.needsUpdate(now, keepAliveTicks))
+            dirtyMask |= 1 << i;
+        if ((controller.heldPresses | controller.heldReleases) != 0 && (nextDue == 0 || controller.latchUntil < nextDue))
+            nextDue = controller.latchUntil;
+    }
+
+    push_dirty_states(dirtyMask, now);
+    return nextDue;
+}
+
+// Neutralises controllers whose slot got no input for input_timeout_ms, so a player who dropped out
+// doesn't leave buttons held down, and detaches them after detach_timeout_ms. Returns the tick the
+// next one is due (0 if none are pending).
+u64 expire_idle_controllers()
+{
+    if (config.input_timeout_ms == 0 && config.detach_timeout_ms == 0)
+        return 0;
+
+    u64 now = svcGetSystemTick();
+    u64 neutralTicks = armNsToTicks(config.input_timeout_ms * 1000000);
+    u64 detachTicks = armNsToTicks(config.detach_timeout_ms * 1000000);
+    u64 nextDue = 0;
+    u32 dirtyMask = 0;
+
+    for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        FakeController& controller = fakeControllerList[i];
+        if (!controller.isInitialized)
+            continue;
+
+        u64 idleFor = now - controller.inputTick;
+        if (detachTicks != 0 && idleFor >= detachTicks)
+        {
+            LOG(LOG_INFO, LOG_CAT_APPLY, "No input for controller %d in %llums, detaching it", i, (unsigned long long)config.detach_timeout_ms);
+            controller.deInitialize();
+            controller.idle = true;
+            continue;
+        }
+        if (!controller.idle && neutralTicks != 0 && idleFor >= neutralTicks)
+        {
+            LOG(LOG_INFO, LOG_CAT_APPLY, "No input for controller %d in %llums, releasing everything", i, (unsigned long long)config.input_timeout_ms);
+            controller.neutralise();
+            controller.idle = true;
+            metric_add(METRIC_TIMEOUTS);
+            if (controller.needsUpdate(now, 0))
+                dirtyMask |= 1 << i;
+        }
+
+        u64 due = 0;
+        if (!controller.idle && neutralTicks != 0)
+            due = controller.inputTick + neutralTicks;
+        else if (detachTicks != 0)
+            due = controller.inputTick + detachTicks;
+        if (due != 0 && (nextDue == 0 || due < nextDue))
+            nextDue = due;
+    }
+
+    push_dirty_states(dirtyMask, now);
+    return nextDue;
+}
+
+// The network thread only receives and decodes, the apply thread does the HID IPC. They share the
+// latest frame through a triple buffer, so a slow IPC never holds up the socket and the apply thread
+// always picks up the most recent complete frame.
+static TripleBuffer<struct input_frame> frameBuffer;
+static LEvent frameEvent;
+// Takes the place of frameBuffer when config.jitter_buffer is set
+static JitterBuffer jitterBuffer;
+static Thread network_thread;
+static Thread apply_thread;
 
 void networkThread(void* _)
 {
-    struct input_message temporal_pkg;
-    printToFile("Starting Network Loop Thread!");
+    u64 carriedPressed[MAX_CONTROLLERS] = {0};
+    u64 carriedReleased[MAX_CONTROLLERS] = {0};
+    LOG(LOG_INFO, LOG_CAT_NET, "Starting Network Loop Thread!");
     while (true)
     {
-        int poll_res = poll_udp_input(&temporal_pkg);
-        mutexLock(&pkgMutex);
+        struct input_frame& frame = frameBuffer.back();
+        int poll_res = poll_udp_input(&frame);
 
-        if (poll_res == 0)
+        if (poll_res > 0)
         {
-            fakeConsState = temporal_pkg;
-            apply_fake_con_state(fakeConsState);
+            frame.info.handoff_tick = svcGetSystemTick();
+            record_stage(STAGE_HANDOFF, frame.info.handoff_tick - frame.info.decode_tick);
         }
-        else
+
+        if (poll_res > 0 && config.jitter_buffer)
         {
-            fakeConsState.magic = 0;
-            svcSleepThread(1e+7l);
+            jitterBuffer.push(frame);
+            TRACE(TRACE_HANDOFF, 0, frame.info.seq, 0);
         }
-        mutexUnlock(&pkgMutex);
+        else if (poll_res > 0)
+        {
+            for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+            {
+                frame.pressed[i] |= carriedPressed[i];
+                frame.released[i] |= carriedReleased[i];
+            }
 
+            // If the apply thread never got to the previous frame, its edges ride along with the next one
+            u32 seq = frame.info.seq;
+            bool overwritten = frameBuffer.publish();
+            TRACE(TRACE_HANDOFF, 0, seq, overwritten);
+            const struct input_frame& unread = frameBuffer.back();
+            for (s32 i = 0; i < MAX_CONTROLLERS; i++)
+            {
+                carriedPressed[i] = overwritten ? unread.pressed[i] : 0;
+                carriedReleased[i] = overwritten ? unread.released[i] : 0;
+            }
+            leventSignal(&frameEvent);
+        }
+        else if (poll_res < 0)
+        {
+            // In event mode poll_udp_input already waited for the socket
+            if (config.receive_mode == RECEIVE_MODE_POLLING)
+                svcSleepThread(1e+7l);
+        }
+
+        // Only once the input is on its way, so replying never holds it up
+        flush_udp_reply();
+        maintain_udp_socket();
         svcSleepThread(-1);
     }
 }
+
+static struct scheduler_stats schedulerStats;
+
+const struct scheduler_stats* get_scheduler_stats()
+{
+    return &schedulerStats;
+}
+
+// Wakes at fixed absolute deadlines and applies whatever the newest frame is at that point, so
+// updates reach HID at a steady rate no matter how bursty the network is
+static void run_fixed_rate(u64 periodTicks)
+{
+    const u64 reportTicks = armGetSystemTickFreq() * LOG_REPORT_SECONDS;
+    u64 deadline = svcGetSystemTick() + periodTicks;
+    u64 lastReport = deadline;
+    u64 windowMax = 0;
+    struct input_frame playoutFrame;
+
+    while (true)
+    {
+        u64 now = svcGetSystemTick();
+        if (deadline > now)
+            svcSleepThread(armTicksToNs(deadline - now));
+
+        now = svcGetSystemTick();
+        u64 late = now > deadline ? now - deadline : 0;
+        schedulerStats.wakeups++;
+        schedulerStats.jitter_sum += late;
+        if (late > schedulerStats.jitter_max)
+            schedulerStats.jitter_max = late;
+        if (late > windowMax)
+            windowMax = late;
+
+        if (config.jitter_buffer)
+        {
+            if (jitterBuffer.pop_due(now, &playoutFrame))
+                apply_fake_con_state(&playoutFrame);
+        }
+        else if (frameBuffer.consume())
+        {
+            apply_fake_con_state(&frameBuffer.front());
+        }
+        expire_button_latches();
+        expire_idle_controllers();
+
+        // If applying took longer than a period, skip to the next deadline still ahead of us
+        // instead of firing the missed ones back to back
+        deadline += periodTicks;
+        now = svcGetSystemTick();
+        if (deadline <= now)
+        {
+            u64 missed = (now - deadline) / periodTicks + 1;
+            schedulerStats.overruns += missed;
+            deadline += missed * periodTicks;
+        }
+
+        if (now - lastReport >= reportTicks)
+        {
+            LOG(LOG_INFO, LOG_CAT_APPLY, "Apply scheduler: %llu wake-ups, %llu overruns, max lateness %lluus in the last %us",
+                (unsigned long long)schedulerStats.wakeups.load(), (unsigned long long)schedulerStats.overruns.load(),
+                (unsigned long long)(armTicksToNs(windowMax) / 1000), LOG_REPORT_SECONDS);
+            if (config.jitter_buffer)
+            {
+                LOG(LOG_INFO, LOG_CAT_APPLY, "Jitter buffer: target delay %lluus, %llu late, %llu dropped, %llu skipped",
+                    (unsigned long long)(armTicksToNs(jitterBuffer.target_delay) / 1000), (unsigned long long)jitterBuffer.late.load(),
+                    (unsigned long long)jitterBuffer.dropped.load(), (unsigned long long)jitterBuffer.skipped.load());
+            }
+            lastReport = now;
+            windowMax = 0;
+        }
+    }
+}
+
+void applyThread(void* _)
+{
+    LOG(LOG_INFO, LOG_CAT_APPLY, "Starting Apply Thread!");
+    if (config.jitter_buffer)
+        run_fixed_rate(armNsToTicks((config.apply_period_us != 0 ? config.apply_period_us : 5000) * 1000));
+    if (config.apply_period_us != 0)
+        run_fixed_rate(armNsToTicks(config.apply_period_us * 1000));
+
+    // Applies as soon as a frame comes in, and otherwise wakes up when a latched tap is due to be released
+    // or a controller is due to time out
+    u64 due = 0;
+    while (true)
+    {
+        u64 timeout = UINT64_MAX;
+        if (due != 0)
+        {
+            u64 now = svcGetSystemTick();
+            timeout = due > now ? armTicksToNs(due - now) : 0;
+        }
+
+        if (leventWait(&frameEvent, timeout) && frameBuffer.consume())
+            apply_fake_con_state(&frameBuffer.front());
+        u64 latchDue = expire_button_latches();
+        u64 idleDue = expire_idle_controllers();
+        due = latchDue == 0 || (idleDue != 0 && idleDue < latchDue) ? idleDue : latchDue;
+    }
+}
+
+const JitterBuffer* get_jitter_buffer()
+{
+    return &jitterBuffer;
+}
+
+void startInputThreads()
+{
+    leventInit(&frameEvent, false, true);
+    jitterBuffer.configure(armNsToTicks(config.jitter_min_us * 1000), armNsToTicks(config.jitter_max_us * 1000));
+    threadCreate(&network_thread, networkThread, NULL, NULL, 0x2000, 0x30, 3);
+    threadCreate(&apply_thread, applyThread, NULL, NULL, 0x2000, 0x30, 3);
+    threadStart(&network_thread);
+    threadStart(&apply_thread);
+}
@@ -4,11 +4,12 @@
 #include <stdlib.h>
 #include <string.h>
 
-// Include the main libnx system header, for Switch development
-#include <switch.h>
+// Include the main libnx system header, for Switch development (or the host stand-ins)
+#include "platform.hpp"
+#include "logger.hpp"
 
-// Yes, I know this is from main, but I don't want to make a "main.hpp" just for this
-int printToFile(const char* myString);
+// Filled in by hiddbgAttachHdlsWorkBuffer at startup, needed for the HDLS state list calls
+extern HiddbgHdlsSessionId hdlsSessionId;
 
 class FakeController {
 public:
@@ -18,5 +19,27 @@ public:
     int initialize(u16);
     int deInitialize();
     bool isInitialized = false;
+
+    // What HID last got from us, so unchanged states don't cost an IPC round-trip
+    HiddbgHdlsState sentState = {0};
+    u64 sentTick = 0;
+    bool hasSentState = false;
+    bool needsUpdate(u64 now, u64 keepAliveTicks);
+    void markSent(u64 now);
+
+    // Taps (and quick release + re-press) the client saw between two frames, kept in the state until
+    // latchUntil so that HID samples them at least once
+    u64 baseButtons = 0;
+    u64 heldPresses = 0;
+    u64 heldReleases = 0;
+    u64 latchUntil = 0;
+    void setButtons(u64 keys, u64 pressed, u64 released, u64 now, u64 holdTicks);
+    bool expireLatches(u64 now);
+
+    // Input for this slot stopped coming in: it's neutral, then detached, until some arrives again
+    u64 inputTick = 0; // recv_tick of the last datagram it got input from
+    bool idle = false;
+    u32 ownerGen = 0; // slot_owner_gen of the client it belongs to
+    void neutralise();
     
 };
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "config.hpp"
+#include "con_manager.hpp"
+#include <ctype.h>
+
+hidplus_config config;
+
+struct config_key
+{
+    const char* name;
+    u64* value;
+    const char* const* names; // For enums, nullptr terminated and in enum order
+    bool flags = false;       // names are bits instead, the value is a comma separated list of them (or "all")
+};
+
+static const char* const apply_mode_names[] = {"single", "batch", nullptr};
+static const char* const receive_mode_names[] = {"polling", "event", "drain", nullptr};
+static const char* const anarchy_buttons_names[] = {"or", "majority", "last", nullptr};
+static const char* const anarchy_sticks_names[] = {"average", "last", nullptr};
+static const char* const log_level_names[] = {"error", "warn", "info", "debug", "trace", nullptr};
+static const char* const log_category_names[] = {"general", "net", "hid", "apply", "stats", "config", nullptr};
+
+static const config_key config_keys[] = {
+    {"keepalive_ms", &config.keepalive_ms, nullptr},
+    {"apply_mode", &config.apply_mode, apply_mode_names},
+    {"receive_mode", &config.receive_mode, receive_mode_names},
+    {"apply_period_us", &config.apply_period_us, nullptr},
+    {"jitter_buffer", &config.jitter_buffer, nullptr},
+    {"jitter_min_us", &config.jitter_min_us, nullptr},
+    {"jitter_max_us", &config.jitter_max_us, nullptr},
+    {"tap_hold_us", &config.tap_hold_us, nullptr},
+    {"anarchy", &config.anarchy, nullptr},
+    {"anarchy_buttons", &config.anarchy_buttons, anarchy_buttons_names},
+    {"anarchy_sticks", &config.anarchy_sticks, anarchy_sticks_names},
+    {"reply_interval_ms", &config.reply_interval_ms, nullptr},
+    {"session_timeout_ms", &config.session_timeout_ms, nullptr},
+    {"input_timeout_ms", &config.input_timeout_ms, nullptr},
+    {"detach_timeout_ms", &config.detach_timeout_ms, nullptr},
+    {"log_level", &config.log_level, log_level_names},
+    {"log_categories", &config.log_categories, log_category_names, true},
+    {"trace", &config.trace, nullptr},
+};
+
+static char* trim(char* str)
+{
+    while (isspace((unsigned char)*str))
+        str++;
+    char* end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+    return str;
+}
+
+static s64 find_name(const char* const* names, const char* value)
+{
+    for (s64 i = 0; names[i] != nullptr; i++)
+    {
+        if (strcmp(names[i], value) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// "net, hid" -> the bits of both, false if any of them isn't known
+static bool parse_flags(const char* const* names, char* value, u64* out)
+{
+    u64 flags = 0;
+    for (char* token = strtok(value, ","); token != nullptr; token = strtok(nullptr, ","))
+    {
+        token = trim(token);
+        s64 bit = find_name(names, token);
+        if (strcmp(token, "all") == 0)
+            flags = ~0ull;
+        else if (bit >= 0)
+            flags |= 1ull << bit;
+        else
+            return false;
+    }
+    *out = flags;
+    return true;
+}
+
+static void set_value(const char* key, const char* value)
+{
+    for (const config_key& entry : config_keys)
+    {
+        if (strcmp(entry.name, key) != 0)
+            continue;
+
+        if (entry.flags)
+        {
+            char list[128];
+            snprintf(list, sizeof(list), "%s", value);
+            if (parse_flags(entry.names, list, entry.value))
+                return;
+            break;
+        }
+
+        if (entry.names != nullptr)
+        {
+            s64 index = find_name(entry.names, value);
+            if (index < 0)
+                break;
+            *entry.value = index;
+            return;
+        }
+
+        char* end;
+        u64 parsed = strtoull(value, &end, 0);
+        if (end == value || *end != '\0')
+            break;
+        *entry.value = parsed;
+        return;
+    }
+
+    LOG(LOG_WARN, LOG_CAT_CONFIG, "Ignoring config entry %s = %s", key, value);
+}
+
+int load_config(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+        return -1;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        char* comment = strpbrk(line, "#;");
+        if (comment != nullptr)
+            *comment = '\0';
+
+        char* separator = strchr(line, '=');
+        if (separator == nullptr)
+            continue;
+        *separator = '\0';
+
+        char* key = trim(line);
+        char* value = trim(separator + 1);
+        if (*key != '\0')
+            set_value(key, value);
+    }
+
+    fclose(file);
+    return 0;
+}
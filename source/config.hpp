@@ -0,0 +1,65 @@
+#pragma once
+#include "platform.hpp"
+#include "logger.hpp"
+#include "anarchy.hpp"
+
+// Optional settings file on the SD card, one "key = value" per line, '#' or ';' starts a comment.
+// Missing file or unknown keys just leave the defaults below.
+#define CONFIG_PATH "/hidplus/config.ini"
+
+// How controller states are handed to HID
+enum apply_mode
+{
+    APPLY_MODE_SINGLE, // One hiddbgSetHdlsState per controller
+    APPLY_MODE_BATCH,  // One hiddbgApplyHdlsStateList for all of them [7.0.0+], single otherwise
+};
+
+// How the network thread reads the socket
+enum receive_mode
+{
+    RECEIVE_MODE_POLLING, // Read every third loop, with the socket timeout in between (hid-mitm style)
+    RECEIVE_MODE_EVENT,   // Block in poll() until a datagram arrives
+    RECEIVE_MODE_DRAIN,   // Same, then read everything queued and keep only the newest
+};
+
+// Values are all u64 so they can share one parser, enums are stored by index
+struct hidplus_config
+{
+    // An unchanged controller state is only re-sent to HID this often (0 = never)
+    u64 keepalive_ms = 1000;
+    u64 apply_mode = APPLY_MODE_BATCH;
+    u64 receive_mode = RECEIVE_MODE_DRAIN;
+    // Apply the latest input at this fixed period instead of whenever a packet arrives (0 = on arrival).
+    // HID samples controllers about every 5ms, so 5000 keeps one update per sample.
+    u64 apply_period_us = 0;
+    // Hold input back by an adaptive delay between jitter_min_us and jitter_max_us to even out bursts.
+    // Needs the fixed-rate scheduler, 5000us is used if apply_period_us isn't set.
+    u64 jitter_buffer = 0;
+    u64 jitter_min_us = 0;
+    u64 jitter_max_us = 20000;
+    // A tap that started and ended between two packets is held down for this long, long enough for
+    // at least one HID sample to see it
+    u64 tap_hold_us = 8000;
+    // A client that sent nothing for this long may restart its sequence numbers, and gives its
+    // controller slots back if a new client needs them
+    u64 session_timeout_ms = 1000;
+    // A controller that got no input for input_timeout_ms has every button released and its sticks
+    // centred, after detach_timeout_ms it's unplugged (0 = never for either)
+    u64 input_timeout_ms = 1000;
+    u64 detach_timeout_ms = 0;
+    // 1 merges the first controller of every client into one, see anarchy.hpp for the policies
+    u64 anarchy = 0;
+    u64 anarchy_buttons = ANARCHY_BUTTONS_OR;
+    u64 anarchy_sticks = ANARCHY_STICKS_AVERAGE;
+    // Clients that ask for replies get at most one every this many ms (0 = one per wake-up)
+    u64 reply_interval_ms = 10;
+    // What ends up in /hidplus/log.txt, a log_control packet can change both at runtime
+    u64 log_level = LOG_INFO;
+    u64 log_categories = LOG_CAT_ALL;
+    // 1 writes a binary trace of the input path to /hidplus/trace.bin, see host/tools/trace2json.cpp
+    u64 trace = 0;
+};
+
+extern hidplus_config config;
+
+int load_config(const char* path);
@@ -0,0 +1,102 @@
+#include "jitter_buffer.hpp"
+
+// The smallest transit is re-measured over windows of this many seconds so clock drift between the
+// client and us doesn't accumulate
+#define OFFSET_WINDOW_SECONDS 2
+
+void JitterBuffer::configure(u64 minDelayTicks, u64 maxDelayTicks)
+{
+    min_delay = minDelayTicks;
+    max_delay = maxDelayTicks > minDelayTicks ? maxDelayTicks : minDelayTicks;
+    target_delay = min_delay;
+}
+
+u64 JitterBuffer::ideal_arrival(const struct input_frame& frame)
+{
+    u64 arrival = frame.info.recv_tick;
+    if (!frame.info.has_seq)
+        return arrival;
+
+    u64 sent = armNsToTicks(frame.info.send_time_us * 1000);
+    s64 offset = (s64)(arrival - sent);
+
+    transit_window& transit = transits[frame.info.session % MAX_SESSIONS];
+    if (arrival - transit.window_start >= armGetSystemTickFreq() * OFFSET_WINDOW_SECONDS)
+    {
+        transit.offset_prev_min = transit.offset_min;
+        transit.offset_min = INT64_MAX;
+        transit.window_start = arrival;
+    }
+    if (offset < transit.offset_min)
+        transit.offset_min = offset;
+
+    s64 base = transit.offset_min < transit.offset_prev_min ? transit.offset_min : transit.offset_prev_min;
+    return sent + (u64)base;
+}
+
+void JitterBuffer::push(const struct input_frame& frame)
+{
+    u64 arrival = frame.info.recv_tick;
+    u64 ideal = ideal_arrival(frame);
+    u64 excess = arrival > ideal ? arrival - ideal : 0;
+
+    // Same smoothing as RTT estimation in TCP: 1/8 for the mean, 1/4 for the deviation
+    u64 diff = excess > excess_mean ? excess - excess_mean : excess_mean - excess;
+    excess_mean = excess_mean - excess_mean / 8 + excess / 8;
+    excess_dev = excess_dev - excess_dev / 4 + diff / 4;
+
+    u64 target = excess_mean + 3 * excess_dev;
+    if (target < min_delay)
+        target = min_delay;
+    if (target > max_delay)
+        target = max_delay;
+    target_delay = target;
+
+    u64 playout = ideal + target;
+    if (arrival > playout)
+        late++;
+
+    u32 write = head.load(std::memory_order_relaxed);
+    if (write - tail.load(std::memory_order_acquire) >= capacity)
+    {
+        dropped++;
+        return;
+    }
+    entries[write % capacity].frame = frame;
+    entries[write % capacity].playout_tick = playout;
+    head.store(write + 1, std::memory_order_release);
+}
+
+bool JitterBuffer::pop_due(u64 now, struct input_frame* out)
+{
+    u32 read = tail.load(std::memory_order_relaxed);
+    u32 available = head.load(std::memory_order_acquire);
+    u32 newest = read;
+    bool found = false;
+
+    while (read != available && entries[read % capacity].playout_tick <= now)
+    {
+        if (found)
+            skipped++;
+        newest = read;
+        found = true;
+        read++;
+    }
+
+    // Copy before handing the slots back to the network thread. Skipped frames still hand over
+    // their button edges so short taps aren't lost.
+    if (found)
+    {
+        *out = entries[newest % capacity].frame;
+        for (u32 i = tail.load(std::memory_order_relaxed); i != newest; i++)
+        {
+            for (int c = 0; c < MAX_CONTROLLERS; c++)
+            {
+                out->pressed[c] |= entries[i % capacity].frame.pressed[c];
+                out->released[c] |= entries[i % capacity].frame.released[c];
+            }
+        }
+    }
+    tail.store(read, std::memory_order_release);
+    return found;
+}
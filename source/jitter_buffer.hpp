@@ -0,0 +1,61 @@
+#pragma once
+#include "platform.hpp"
+#include "udp_manager.hpp"
+#include <atomic>
+
+// Holds frames for a short, adaptive delay so they reach HID evenly spaced even when the network
+// delivers them in bursts. The network thread pushes, the apply thread pops on its fixed period.
+//
+// Every frame gets an ideal arrival tick: its send timestamp moved onto our clock with the smallest
+// transit seen lately from the same client, which has a clock of its own (or just its arrival tick for
+// legacy packets without one). How much later than
+// that frames actually arrive is tracked as a mean and deviation, and frames are released at
+// ideal + mean + 3 * deviation, clamped to the configured bounds.
+class JitterBuffer
+{
+public:
+    void configure(u64 minDelayTicks, u64 maxDelayTicks);
+
+    // Network thread
+    void push(const struct input_frame& frame);
+
+    // Apply thread: the newest frame due at now, false if nothing is
+    bool pop_due(u64 now, struct input_frame* out);
+
+    // Readable from any thread
+    std::atomic<u64> target_delay{0}; // Ticks
+    std::atomic<u64> late{0};         // Arrived after their release time
+    std::atomic<u64> dropped{0};      // Didn't fit in the buffer
+    std::atomic<u64> skipped{0};      // Released together with a newer frame, only the newest was applied
+
+private:
+    static const u32 capacity = 32;
+
+    struct entry
+    {
+        struct input_frame frame;
+        u64 playout_tick;
+    };
+
+    u64 ideal_arrival(const struct input_frame& frame);
+
+    entry entries[capacity];
+    std::atomic<u32> head{0}; // Next slot to write, only the network thread moves it
+    std::atomic<u32> tail{0}; // Next slot to read, only the apply thread moves it
+
+    u64 min_delay = 0;
+    u64 max_delay = 0;
+
+    // Network thread only. The smallest transit per client session, this window and the one before.
+    struct transit_window
+    {
+        s64 offset_min = INT64_MAX;
+        s64 offset_prev_min = INT64_MAX;
+        u64 window_start = 0;
+    };
+    transit_window transits[MAX_SESSIONS];
+    u64 excess_mean = 0;
+    u64 excess_dev = 0;
+};
+
+const JitterBuffer* get_jitter_buffer();
@@ -0,0 +1,245 @@
+#include "logger.hpp"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Must be a power of two
+#define LOG_RING_SLOTS 256
+
+// How often the writer wakes up to empty the ring
+#define LOG_WRITE_INTERVAL_MS 50
+
+// Bounded multi-producer queue after Dmitry Vyukov's: a slot's sequence says whose turn it is, so a
+// producer claims one with a single compare-exchange and the writer only has to look at the next one.
+// Sequences are stored minus the slot's index, so the all-zero ring is ready before any constructor runs.
+struct log_slot
+{
+    std::atomic<u32> sequence;
+    u8 kind;
+    u16 length;
+    u64 tick;
+    char payload[LOG_MAX_PAYLOAD];
+};
+
+// Up to info, everything, until the config says otherwise
+std::atomic<u32> log_enabled[LOG_LEVEL_COUNT] = {{LOG_CAT_ALL}, {LOG_CAT_ALL}, {LOG_CAT_ALL}, {0}, {0}};
+
+void log_configure(u32 level, u32 categories)
+{
+    for (u32 i = 0; i < LOG_LEVEL_COUNT; i++)
+        log_enabled[i].store(i <= level ? categories : 0, std::memory_order_relaxed);
+}
+
+static log_slot slots[LOG_RING_SLOTS];
+static std::atomic<u32> ringHead{0};
+static u32 ringTail = 0; // Writer thread only
+static log_stats logStats;
+
+static Thread writer_thread;
+static const char* textFilePath = nullptr;
+static const char* binaryFilePath = nullptr;
+
+static u32 load_sequence(const log_slot* slot, std::memory_order order)
+{
+    return slot->sequence.load(order) + (u32)(slot - slots);
+}
+
+static void store_sequence(log_slot* slot, u32 sequence)
+{
+    slot->sequence.store(sequence - (u32)(slot - slots), std::memory_order_release);
+}
+
+// Claims the next free slot, nullptr if the ring is full. Has to be handed back with publish_slot.
+static log_slot* claim_slot(u32* position)
+{
+    u32 pos = ringHead.load(std::memory_order_relaxed);
+    while (true)
+    {
+        log_slot* slot = &slots[pos % LOG_RING_SLOTS];
+        s32 diff = (s32)(load_sequence(slot, std::memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (ringHead.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                *position = pos;
+                return slot;
+            }
+        }
+        else if (diff < 0)
+        {
+            logStats.dropped++;
+            return nullptr;
+        }
+        else
+        {
+            pos = ringHead.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void publish_slot(log_slot* slot, u32 position)
+{
+    slot->tick = svcGetSystemTick();
+    store_sequence(slot, position + 1);
+    logStats.pushed++;
+}
+
+bool log_text(const char* text)
+{
+    u32 position;
+    log_slot* slot = claim_slot(&position);
+    if (slot == nullptr)
+        return false;
+
+    size_t length = strlen(text);
+    if (length > LOG_MAX_PAYLOAD)
+        length = LOG_MAX_PAYLOAD;
+    memcpy(slot->payload, text, length);
+    slot->kind = LOG_KIND_TEXT;
+    slot->length = length;
+    publish_slot(slot, position);
+    return true;
+}
+
+bool log_printf(const char* format, ...)
+{
+    u32 position;
+    log_slot* slot = claim_slot(&position);
+    if (slot == nullptr)
+        return false;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(slot->payload, LOG_MAX_PAYLOAD, format, args);
+    va_end(args);
+
+    slot->kind = LOG_KIND_TEXT;
+    slot->length = length < 0 ? 0 : (length >= LOG_MAX_PAYLOAD ? LOG_MAX_PAYLOAD - 1 : length);
+    publish_slot(slot, position);
+    return true;
+}
+
+bool log_binary(u8 kind, const void* data, u16 size)
+{
+    if (size > LOG_MAX_PAYLOAD)
+        return false;
+
+    u32 position;
+    log_slot* slot = claim_slot(&position);
+    if (slot == nullptr)
+        return false;
+
+    memcpy(slot->payload, data, size);
+    slot->kind = kind;
+    slot->length = size;
+    publish_slot(slot, position);
+    return true;
+}
+
+// One of the writer's files. Opened lazily and retried, the SD card may not be there yet (or at all).
+// Rotated past maxSize, but only if it's a regular file, not /dev/stderr in the host build.
+struct log_file
+{
+    const char* path;
+    const char* mode;
+    u64 maxSize;
+    FILE* file;
+    u64 size;
+    bool rotates;
+};
+
+static FILE* open_log_file(log_file* f)
+{
+    if (f->file == nullptr && f->path != nullptr)
+    {
+        f->file = fopen(f->path, f->mode);
+        struct stat st;
+        f->rotates = f->file != nullptr && fstat(fileno(f->file), &st) == 0 && S_ISREG(st.st_mode);
+        f->size = f->rotates ? st.st_size : 0;
+    }
+    return f->file;
+}
+
+// Closes the file for good if it's full, the next open_log_file starts a new one
+static void count_written(log_file* f, int bytes)
+{
+    f->size += bytes > 0 ? bytes : 0;
+    if (!f->rotates || f->size < f->maxSize)
+        return;
+
+    char oldPath[256];
+    snprintf(oldPath, sizeof(oldPath), "%s.old", f->path);
+    fclose(f->file);
+    f->file = nullptr;
+    remove(oldPath);
+    // Without the rename it's started over right here
+    if (rename(f->path, oldPath) != 0)
+        remove(f->path);
+}
+
+static void writerThread(void* _)
+{
+    log_file text = {textFilePath, "a", LOG_MAX_SIZE};
+    log_file binary = {binaryFilePath, "ab", TRACE_MAX_SIZE};
+    u64 reportedDrops = 0;
+
+    while (true)
+    {
+        svcSleepThread((s64)LOG_WRITE_INTERVAL_MS * 1000000);
+
+        while (true)
+        {
+            log_slot* slot = &slots[ringTail % LOG_RING_SLOTS];
+            if (load_sequence(slot, std::memory_order_acquire) != ringTail + 1)
+                break;
+
+            if (slot->kind == LOG_KIND_TEXT && open_log_file(&text) != nullptr)
+            {
+                int written = fprintf(text.file, "[%10.3f] %.*s\n", armTicksToNs(slot->tick) / 1e9, (int)slot->length, slot->payload);
+                count_written(&text, written);
+                logStats.written++;
+            }
+            else if (slot->kind != LOG_KIND_TEXT && open_log_file(&binary) != nullptr)
+            {
+                struct log_record_header header = {slot->kind, 0, slot->length, 0, slot->tick};
+                fwrite(&header, sizeof(header), 1, binary.file);
+                fwrite(slot->payload, 1, slot->length, binary.file);
+                count_written(&binary, sizeof(header) + slot->length);
+                logStats.written++;
+            }
+
+            store_sequence(slot, ringTail + LOG_RING_SLOTS);
+            ringTail++;
+        }
+
+        u64 dropped = logStats.dropped;
+        if (dropped != reportedDrops && open_log_file(&text) != nullptr)
+        {
+            int written = fprintf(text.file, "(%llu log records dropped, the ring was full)\n", (unsigned long long)(dropped - reportedDrops));
+            count_written(&text, written);
+            reportedDrops = dropped;
+        }
+
+        if (text.file != nullptr)
+            fflush(text.file);
+        if (binary.file != nullptr)
+            fflush(binary.file);
+    }
+}
+
+void log_start(const char* textPath, const char* binaryPath)
+{
+    if (textFilePath != nullptr || binaryFilePath != nullptr)
+        return;
+    textFilePath = textPath;
+    binaryFilePath = binaryPath;
+    // Lowest priority, it only ever runs when input has nothing to do
+    threadCreate(&writer_thread, writerThread, NULL, NULL, 0x2000, 0x3F, 3);
+    threadStart(&writer_thread);
+}
+
+const log_stats* get_log_stats()
+{
+    return &logStats;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include "platform.hpp"
+#include <atomic>
+
+// Log lines and binary records go into a fixed-size lock-free ring that any thread can push into
+// without ever waiting, and a low-priority thread writes them out to the SD card in batches. A full
+// ring drops the record (and counts it) instead of holding up input.
+#define LOG_PATH "/hidplus/log.txt"
+#define TRACE_PATH "/hidplus/trace.bin"
+
+// Past these a file is renamed to <path>.old and started over, so the two of them never take much
+// more than twice that on the SD card. The trace can be turned on over the network, it needs a cap too.
+#define LOG_MAX_SIZE (256 * 1024)
+#define TRACE_MAX_SIZE (4 * 1024 * 1024)
+
+// Text goes to the log file, every other kind is a binary record for the trace file
+#define LOG_KIND_TEXT 0
+
+// Largest record, text past this gets cut
+#define LOG_MAX_PAYLOAD 176
+
+// Binary records in the trace file, back to back, each followed by length bytes of payload
+struct __attribute__((__packed__)) log_record_header
+{
+    u8 kind;
+    u8 reserved;
+    u16 length;
+    u32 reserved2;
+    u64 tick; // svcGetSystemTick when it was pushed
+};
+
+enum log_level
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+    LOG_TRACE,
+    LOG_LEVEL_COUNT,
+};
+
+// Subsystems, as bits so any mix of them can be turned on
+#define LOG_CAT_GENERAL 0x01
+#define LOG_CAT_NET 0x02    // Socket and packets
+#define LOG_CAT_HID 0x04    // Virtual controllers and hiddbg calls
+#define LOG_CAT_APPLY 0x08  // Apply thread, scheduler and jitter buffer
+#define LOG_CAT_STATS 0x10  // Periodic latency reports
+#define LOG_CAT_CONFIG 0x20
+#define LOG_CAT_ALL 0xffffffff
+
+// Periodic reports (latency stages, clock sync, apply scheduler) each cover this many seconds
+#define LOG_REPORT_SECONDS 10
+
+// For every level, the categories that log at it. Only log_configure writes it.
+extern std::atomic<u32> log_enabled[LOG_LEVEL_COUNT];
+
+// A disabled level and category costs one load and one branch, the arguments aren't even evaluated
+#define LOG_ENABLED(level, category) \
+    __builtin_expect((log_enabled[level].load(std::memory_order_relaxed) & (category)) != 0, 0)
+
+#define LOG(level, category, ...)              \
+    do                                         \
+    {                                          \
+        if (LOG_ENABLED(level, category))      \
+            log_printf(__VA_ARGS__);           \
+    } while (0)
+
+// Everything up to and including level, for the given categories
+void log_configure(u32 level, u32 categories);
+
+// Runtime change of the log settings, sent to the input port
+#define LOG_CONTROL_MAGIC 0x327b
+
+struct __attribute__((__packed__)) log_control
+{
+    u16 magic;
+    u8 level; // log_level
+    u8 trace; // 1 to write the binary trace (trace.hpp), 0 to stop
+    u32 categories; // LOG_CAT_* bits
+};
+
+struct log_stats
+{
+    std::atomic<u64> pushed{0};
+    std::atomic<u64> dropped{0}; // Ring was full
+    std::atomic<u64> written{0}; // Made it to a file
+};
+
+// Any thread, false if the record was dropped
+bool log_text(const char* text);
+bool log_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+bool log_binary(u8 kind, const void* data, u16 size);
+
+// Starts the writer thread. Records pushed before this are kept (as long as they fit).
+void log_start(const char* textPath, const char* binaryPath);
+const log_stats* get_log_stats();
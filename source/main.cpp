@@ -9,15 +9,15 @@
 // Other stuff
 #include "con_manager.hpp"
 #include "udp_manager.hpp"
+#include "config.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
 #include <optional>
 #include <mutex>
 
-// Log text
-#define IS_RELEASE 1
-
 static const SocketInitConfig sockInitConf = {
     .bsdsockets_version = 1,
 
@@ -111,8 +111,7 @@ extern "C" {
         if (R_FAILED(rc))
             fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_FS));
 
-        HiddbgHdlsSessionId* sessionId;
-        rc = hiddbgAttachHdlsWorkBuffer(sessionId);
+        rc = hiddbgAttachHdlsWorkBuffer(&hdlsSessionId);
         if (R_FAILED(rc))
             fatalThrow(MAKERESULT(Module_Libnx, LibnxError_InitFail_HID));
 
@@ -152,26 +151,8 @@ extern "C" {
     }
 }
 
-static Mutex fileMutex;
-int printToFile(const char* myString)
-{
-    #if IS_RELEASE == 0
-    mutexLock(&fileMutex);
-    FILE *log = fopen("/hidplus/log.txt", "w+a");
-    if (log != nullptr) {
-            fprintf(log, "%s\n", myString);
-            fclose(log);
-    }
-    mutexUnlock(&fileMutex);
-    return 0;
-    #else
-    return -1;
-    #endif
-}
-
 // Main program entrypoint
 u64 mainLoopSleepTime = 50;
-static Thread network_thread;
 int main(int argc, char* argv[])
 {
     // Initialization code can go here.
@@ -179,12 +160,16 @@ int main(int argc, char* argv[])
     // Your code / main loop goes here.
     // If you need threads, you can use threadCreate etc.
 
-    printToFile("READY NEW!");
-    printToFile("MEGA READY! :)");
+    log_start(LOG_PATH, TRACE_PATH);
+    LOG(LOG_INFO, LOG_CAT_GENERAL, "READY NEW!");
+    LOG(LOG_INFO, LOG_CAT_GENERAL, "MEGA READY! :)");
+    if (load_config(CONFIG_PATH) != 0)
+        LOG(LOG_INFO, LOG_CAT_CONFIG, "No config file, using defaults.");
+    log_configure(config.log_level, config.log_categories);
+    trace_enabled = config.trace != 0;
     FakeController testController;
     
-    threadCreate(&network_thread, networkThread, NULL, NULL, 0x1000, 0x30, 3);
-    threadStart(&network_thread);
+    startInputThreads();
     
     while (appletMainLoop()) // Main loop
     {
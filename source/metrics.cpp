@@ -0,0 +1,31 @@
+#include "metrics.hpp"
+
+const char* const metric_names[METRIC_COUNT] = {
+    "received", "invalid", "stale", "coalesced", "recovered", "lost", "unresolved",
+    "link_up", "link_downs", "ipc_failures", "last_ipc_error", "attaches", "detaches", "controllers", "stats_requests",
+    "slot0_updates", "slot1_updates", "slot2_updates", "slot3_updates",
+    "slot4_updates", "slot5_updates", "slot6_updates", "slot7_updates",
+    "slot0_rate", "slot1_rate", "slot2_rate", "slot3_rate",
+    "slot4_rate", "slot5_rate", "slot6_rate", "slot7_rate",
+    "sessions", "rejected", "timeouts", "socket_rebuilds",
+};
+
+std::atomic<u64> metrics[METRIC_COUNT] = {};
+
+void update_slot_rates(u64 now)
+{
+    static u64 sampleTick = 0;
+    static u64 sampled[MAX_CONTROLLERS] = {0};
+
+    u64 elapsed = now - sampleTick;
+    if (elapsed < armGetSystemTickFreq())
+        return;
+
+    for (u32 i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        u64 updates = metric_get(METRIC_SLOT_UPDATES + i);
+        metric_set(METRIC_SLOT_RATE + i, (updates - sampled[i]) * armGetSystemTickFreq() / elapsed);
+        sampled[i] = updates;
+    }
+    sampleTick = now;
+}
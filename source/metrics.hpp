@@ -0,0 +1,55 @@
+#pragma once
+#include "platform.hpp"
+#include "udp_manager.hpp"
+#include <atomic>
+
+// Counters and gauges any thread can bump or read, answered to stats_requests on the input port.
+// Counters only ever go up since boot, gauges hold a current value. The ids are the order values come
+// in a stats_reply, so new ones only ever get appended.
+enum metric_id
+{
+    METRIC_RECEIVED,         // Datagrams read from the socket
+    METRIC_INVALID,          // Wrong magic or malformed
+    METRIC_STALE,            // At or behind the newest sequence we already had
+    METRIC_COALESCED,        // Valid, but a newer one was queued behind it (RECEIVE_MODE_DRAIN)
+    METRIC_RECOVERED,        // Missed datagrams whose buttons were rebuilt from a later one's history
+    METRIC_LOST,             // Missed datagrams the history didn't reach back to
+    METRIC_UNRESOLVED,       // Deltas against a baseline we don't have (anymore)
+    METRIC_LINK_UP,          // Gauge, 1 while input is coming in
+    METRIC_LINK_DOWNS,       // Times no input came in for long enough to consider the link down
+    METRIC_IPC_FAILURES,     // hiddbg calls that returned an error
+    METRIC_LAST_IPC_ERROR,   // Gauge, Result of the last one that did
+    METRIC_ATTACHES,
+    METRIC_DETACHES,
+    METRIC_CONTROLLERS,      // Gauge, attached right now
+    METRIC_STATS_REQUESTS,
+    METRIC_SLOT_UPDATES,     // One per controller slot: states handed to HID
+    METRIC_SLOT_RATE = METRIC_SLOT_UPDATES + MAX_CONTROLLERS, // Gauges, one per slot: updates per second
+    METRIC_SESSIONS = METRIC_SLOT_RATE + MAX_CONTROLLERS, // Gauge, clients with slots of their own
+    METRIC_REJECTED,         // Input from a new client while every slot was taken, log_control from a stranger
+    METRIC_TIMEOUTS,         // Controllers neutralised because their input stopped
+    METRIC_SOCKET_REBUILDS,  // After a socket error or an IP change
+    METRIC_COUNT,
+};
+
+extern const char* const metric_names[METRIC_COUNT];
+extern std::atomic<u64> metrics[METRIC_COUNT];
+
+static inline void metric_add(u32 id, u64 amount = 1)
+{
+    metrics[id].fetch_add(amount, std::memory_order_relaxed);
+}
+
+static inline void metric_set(u32 id, u64 value)
+{
+    metrics[id].store(value, std::memory_order_relaxed);
+}
+
+static inline u64 metric_get(u32 id)
+{
+    return metrics[id].load(std::memory_order_relaxed);
+}
+
+// Recomputes the METRIC_SLOT_RATE gauges over the time since they were last recomputed, if that's at
+// least a second. Only called by the thread answering stats requests.
+void update_slot_rates(u64 now);
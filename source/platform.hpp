@@ -0,0 +1,10 @@
+#pragma once
+// Everything the sysmodule uses from libnx (hiddbg, svc, Mutex...) comes through this header.
+// On the console it is just <switch.h>. Anywhere else we pull in the stand-ins from host/include,
+// which let the receive -> apply path be built and benchmarked on a PC (see host/Makefile).
+
+#ifdef __SWITCH__
+#include <switch.h>
+#else
+#include "nx_host.hpp"
+#endif
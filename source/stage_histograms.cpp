@@ -0,0 +1,90 @@
+#include "stage_histograms.hpp"
+#include "con_manager.hpp"
+
+u32 LogHistogram::bucket_of(u64 ticks)
+{
+    if (ticks < (1 << subBits))
+        return (u32)ticks;
+    u32 exponent = 63 - __builtin_clzll(ticks);
+    if (exponent > maxExponent)
+        return bucketCount - 1;
+    u32 sub = (ticks >> (exponent - subBits)) & ((1 << subBits) - 1);
+    return ((exponent - subBits + 1) << subBits) | sub;
+}
+
+u64 LogHistogram::bucket_top(u32 bucket)
+{
+    if (bucket < (1 << subBits))
+        return bucket;
+    u32 exponent = (bucket >> subBits) + subBits - 1;
+    u64 sub = bucket & ((1 << subBits) - 1);
+    return (((1 << subBits) + sub + 1) << (exponent - subBits)) - 1;
+}
+
+void LogHistogram::record(u64 ticks)
+{
+    std::atomic<u32>& bucket = buckets[bucket_of(ticks)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (ticks > maxTicks.load(std::memory_order_relaxed))
+        maxTicks.store(ticks, std::memory_order_relaxed);
+}
+
+u64 LogHistogram::percentile(u32 p) const
+{
+    u64 n = count();
+    if (n == 0)
+        return 0;
+    u64 rank = (n * p + 99) / 100;
+    u64 seen = 0;
+    for (u32 i = 0; i < bucketCount; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return bucket_top(i) < max() ? bucket_top(i) : max();
+    }
+    return max();
+}
+
+const char* const latency_stage_names[STAGE_COUNT] = {"decode", "handoff", "queue", "apply", "total"};
+
+static LogHistogram stageHistograms[STAGE_COUNT];
+
+void record_stage(latency_stage stage, u64 ticks)
+{
+    stageHistograms[stage].record(ticks);
+}
+
+void record_apply_stages(const struct input_info* info, u64 pickupTick, u64 doneTick)
+{
+    static u64 lastReport = 0;
+    if (info->recv_tick == 0)
+        return;
+
+    if (info->handoff_tick != 0 && pickupTick >= info->handoff_tick)
+        record_stage(STAGE_QUEUE, pickupTick - info->handoff_tick);
+    record_stage(STAGE_APPLY, doneTick - pickupTick);
+    if (doneTick >= info->recv_tick)
+        record_stage(STAGE_TOTAL, doneTick - info->recv_tick);
+
+    if (doneTick - lastReport < armGetSystemTickFreq() * LOG_REPORT_SECONDS || !LOG_ENABLED(LOG_INFO, LOG_CAT_STATS))
+        return;
+    lastReport = doneTick;
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "Stage p50/p99/max (us):");
+    for (int i = 0; i < STAGE_COUNT && len < (int)sizeof(line); i++)
+    {
+        const LogHistogram& histogram = stageHistograms[i];
+        len += snprintf(line + len, sizeof(line) - len, " %s %llu/%llu/%llu", latency_stage_names[i],
+                        (unsigned long long)(armTicksToNs(histogram.percentile(50)) / 1000),
+                        (unsigned long long)(armTicksToNs(histogram.percentile(99)) / 1000),
+                        (unsigned long long)(armTicksToNs(histogram.max()) / 1000));
+    }
+    log_text(line);
+}
+
+const LogHistogram* get_stage_histogram(latency_stage stage)
+{
+    return &stageHistograms[stage];
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "platform.hpp"
+#include "udp_manager.hpp"
+#include <atomic>
+
+// Counts of tick durations in logarithmic buckets, four per power of two so any value is reported at
+// most 25% high, and everything up to 2^42 ticks (~63 hours) fits in a fixed set of counters.
+// One thread records, any thread can read.
+class LogHistogram
+{
+public:
+    void record(u64 ticks);
+
+    u64 count() const { return total.load(std::memory_order_relaxed); }
+    u64 max() const { return maxTicks.load(std::memory_order_relaxed); }
+    // Upper end of the bucket holding the given percentile, in ticks, 0 if nothing was recorded
+    u64 percentile(u32 p) const;
+
+private:
+    static const u32 subBits = 2;
+    static const u32 maxExponent = 41;
+    static const u32 bucketCount = ((maxExponent - 1) << subBits) + (1 << subBits);
+
+    static u32 bucket_of(u64 ticks);
+    static u64 bucket_top(u32 bucket);
+
+    std::atomic<u32> buckets[bucketCount] = {};
+    std::atomic<u64> total{0};
+    std::atomic<u64> maxTicks{0};
+};
+
+// Where a frame spends its time between recvfrom and HID
+enum latency_stage
+{
+    STAGE_DECODE,  // recvfrom returned -> validated and accepted
+    STAGE_HANDOFF, // accepted -> handed to the apply thread (draining the rest of the socket included)
+    STAGE_QUEUE,   // handed over -> picked up by the apply thread (wake-up, scheduler period, jitter buffer)
+    STAGE_APPLY,   // picked up -> HID calls returned
+    STAGE_TOTAL,   // recvfrom returned -> HID calls returned
+    STAGE_COUNT,
+};
+
+extern const char* const latency_stage_names[STAGE_COUNT];
+
+// Network thread for STAGE_DECODE and STAGE_HANDOFF, the apply thread for the rest
+void record_stage(latency_stage stage, u64 ticks);
+// Apply thread: records the apply side stages of a frame and logs all of them every now and then
+void record_apply_stages(const struct input_info* info, u64 pickupTick, u64 doneTick);
+const LogHistogram* get_stage_histogram(latency_stage stage);
@@ -0,0 +1,9 @@
+#include "trace.hpp"
+
+std::atomic<bool> trace_enabled{false};
+
+void trace_emit(trace_event event, u64 begin_tick, u32 a, u32 b)
+{
+    struct trace_payload payload = {begin_tick, a, b};
+    log_binary(event, &payload, sizeof(payload));
+}
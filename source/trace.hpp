@@ -0,0 +1,42 @@
+#pragma once
+#include "platform.hpp"
+#include "logger.hpp"
+#include <atomic>
+
+// Binary trace of what the input path did and when, for offline analysis. Events go through the
+// logger's ring as records of their own kind and end up in TRACE_PATH, each one a log_record_header
+// (tick = when it was emitted) followed by a trace_payload. host/tools/trace2json.cpp turns the file
+// into Chrome trace JSON (chrome://tracing, Perfetto).
+enum trace_event
+{
+    TRACE_RECEIVE = 1, // Network thread, span: read and decoded datagrams. a = newest seq, b = datagrams read
+    TRACE_HANDOFF,     // Network thread: frame handed to the apply thread. a = seq, b = 1 if an unread one was replaced
+    TRACE_LINK,        // Network thread: a = 1 when the client showed up, 0 when it went quiet
+    TRACE_APPLY,       // Apply thread, span: a frame applied. a = seq, b = controllers that needed an update
+    TRACE_HID_CALL,    // Apply thread, span: one hiddbg state call. a = controllers it covered, b = Result
+    TRACE_ATTACH,      // Apply thread, span: FakeController::initialize. a = device type, b = Result
+    TRACE_DETACH,      // Apply thread, span: FakeController::deInitialize. a = handle, b = Result
+    TRACE_EVENT_COUNT,
+};
+
+// Spans have the tick they started at, instant events 0
+struct __attribute__((__packed__)) trace_payload
+{
+    u64 begin_tick;
+    u32 a;
+    u32 b;
+};
+
+extern std::atomic<bool> trace_enabled;
+
+#define TRACE_ENABLED() __builtin_expect(trace_enabled.load(std::memory_order_relaxed), 0)
+
+// With tracing off this is a single branch, nothing is evaluated
+#define TRACE(event, begin_tick, a, b)                     \
+    do                                                     \
+    {                                                      \
+        if (TRACE_ENABLED())                               \
+            trace_emit(event, begin_tick, a, b);           \
+    } while (0)
+
+void trace_emit(trace_event event, u64 begin_tick, u32 a, u32 b);
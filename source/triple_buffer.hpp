@@ -0,0 +1,44 @@
+#pragma once
+#include "platform.hpp"
+#include <atomic>
+
+// Single writer / single reader triple buffer. The writer always has a buffer of its own to fill,
+// the reader always has the last one it took, and the third one sits in the middle holding the most
+// recent published value. Neither side ever waits on the other.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Writer side: fill back(), then publish() it. Returns true if the value published before this
+    // one was never consumed, in which case back() now holds that unread value.
+    T& back() { return buffers[backIndex]; }
+
+    bool publish()
+    {
+        u8 old = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel);
+        backIndex = old & indexMask;
+        return (old & freshBit) != 0;
+    }
+
+    // Reader side: consume() takes the latest published value if there's a new one, front() is
+    // whatever was taken last.
+    bool consume()
+    {
+        if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+            return false;
+        u8 old = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = old & indexMask;
+        return true;
+    }
+
+    const T& front() const { return buffers[frontIndex]; }
+
+private:
+    static const u8 indexMask = 0x3;
+    static const u8 freshBit = 0x4;
+
+    T buffers[3] = {};
+    std::atomic<u8> middle{1};
+    u8 backIndex = 0;
+    u8 frontIndex = 2;
+};
@@ -2,9 +2,16 @@
 
 #include "udp_manager.hpp"
 #include "con_manager.hpp"
+#include "config.hpp"
+#include "clock_sync.hpp"
+#include "stage_histograms.hpp"
+#include "trace.hpp"
+#include "metrics.hpp"
+#include "anarchy.hpp"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,109 +19,923 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <stddef.h>
 
 #define PORT 8000
+// How long a single read waits for a datagram
+#define RECV_TIMEOUT_MS 100
+
+// input_message must stay byte-for-byte what the legacy clients send
+static_assert(sizeof(struct controller_record) == 26, "controller_record layout changed");
+static_assert(offsetof(struct controller_record, keys) == 2 && offsetof(struct controller_record, joy_l_x) == 10 &&
+              offsetof(struct controller_record, joy_r_y) == 22, "controller_record layout changed");
+static_assert(offsetof(struct input_message, controllers) == 4, "legacy header is magic + con_count");
+static_assert(sizeof(struct input_message) == 212, "legacy input_message is 212 bytes");
+static_assert(sizeof(struct input_message_v2) == 16, "v2 header layout changed");
+static_assert(sizeof(struct edge_record) == 16, "edge_record layout changed");
+static_assert(sizeof(struct history_header) == 1, "history_header layout changed");
+static_assert(sizeof(struct delta_header) == 4, "delta_header layout changed");
+static_assert(sizeof(struct input_reply) == 60, "input_reply layout changed");
+static_assert(sizeof(struct time_ping) == 32 && sizeof(struct time_pong) == 68, "time_ping/pong layout changed");
+static_assert(sizeof(struct stats_request) == 8 && sizeof(struct stats_reply) == 16, "stats layout changed");
+static_assert(sizeof(struct stats_reply) + METRIC_COUNT * sizeof(u64) <= MAX_DATAGRAM_SIZE, "stats_reply too big");
+static_assert(sizeof(struct input_message_v2) + sizeof(struct delta_header) +
+                  MAX_CONTROLLERS * (1 + sizeof(struct controller_record) + sizeof(struct edge_record)) +
+                  sizeof(struct history_header) + INPUT_MAX_HISTORY * MAX_CONTROLLERS * sizeof(u64) <= MAX_DATAGRAM_SIZE,
+              "the largest valid datagram doesn't fit MAX_DATAGRAM_SIZE");
 
 static int sockfd = -1;
 
 struct sockaddr_in servaddr, cliaddr;
 
-void setup_socket()
+// Closes the old socket before binding a new one, the console's network stack won't bind a second
+// socket to the port while the first is still open, SO_REUSEADDR or not. Until a rebuild succeeds
+// there's no socket at all, and maintain_udp_socket keeps trying.
+static bool setup_socket()
 {
     if (sockfd != -1)
+    {
         close(sockfd);
-    
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        sockfd = -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
     {
-        perror("failed to create the socket");
-        //printToFile("COULDN'T CREATE SOCKET!");
-        exit(EXIT_FAILURE);
+        LOG(LOG_ERROR, LOG_CAT_NET, "Couldn't create the socket (%d)", errno);
+        return false;
     }
 
     struct timeval read_timeout;
     read_timeout.tv_sec = 0;
-    read_timeout.tv_usec = 100000;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout);
+    read_timeout.tv_usec = RECV_TIMEOUT_MS * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout);
 
     memset(&servaddr, 0, sizeof(servaddr));
-    memset(&cliaddr, 0, sizeof(cliaddr));
-
     servaddr.sin_family = AF_INET; // IPv4 address
     servaddr.sin_addr.s_addr = INADDR_ANY;
     servaddr.sin_port = htons(PORT);
 
-    //printToFile("SOCKET CREATION SUCCESS!");
+    if (bind(fd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
+    {
+        LOG(LOG_ERROR, LOG_CAT_NET, "Couldn't bind the socket (%d)", errno);
+        close(fd);
+        return false;
+    }
+    sockfd = fd;
+    return true;
+}
+
+// Bytes per DELTA_FIELD_* bit, in bit order
+static const u8 delta_field_sizes[] = {sizeof(u16), sizeof(u64), sizeof(s32), sizeof(s32), sizeof(s32), sizeof(s32)};
+
+// Length of a delta section for con_count controllers, -1 if it's malformed or runs past available
+static int delta_section_size(const u8* data, size_t available, u8 con_count)
+{
+    size_t used = sizeof(struct delta_header);
+    for (u8 i = 0; i < con_count; i++)
+    {
+        if (available < used + 1)
+            return -1;
+        u8 fields = data[used++];
+        if ((fields & ~DELTA_FIELDS_ALL) != 0)
+            return -1;
+        for (u32 f = 0; f < sizeof(delta_field_sizes); f++)
+        {
+            if (fields & (1 << f))
+                used += delta_field_sizes[f];
+        }
+    }
+    return available < used ? -1 : (int)used;
+}
+
+// Validates a datagram of either format and points view at its controllers, returns 0 if it was valid
+int decode_input_message(const void* data, int size, struct input_view* view, struct input_info* info)
+{
+    if (size < (int)sizeof(u16))
+        return -1;
+
+    u16 magic;
+    memcpy(&magic, data, sizeof(magic));
+
+    if (magic == INPUT_MSG_MAGIC)
+    {
+        if (size < (int)sizeof(struct input_message))
+            return -1;
+        const struct input_message* message = (const struct input_message*)data;
+        if (message->con_count > MAX_CONTROLLERS)
+            return -1;
+
+        view->con_count = message->con_count;
+        view->controllers = message->controllers;
+        view->delta = nullptr;
+        view->edges = nullptr;
+        view->history_count = 0;
+        view->history = nullptr;
+        info->has_seq = false;
+        info->flags = 0;
+        info->seq = 0;
+        info->send_time_us = 0;
+        return 0;
+    }
 
-    bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr));
+    if (magic == INPUT_MSG_V2_MAGIC)
+    {
+        if (size < (int)sizeof(struct input_message_v2))
+            return -1;
+        const struct input_message_v2* header = (const struct input_message_v2*)data;
+        if (header->con_count > MAX_CONTROLLERS || (header->flags & ~INPUT_FLAGS_KNOWN) != 0)
+            return -1;
+        const u8* records = (const u8*)(header + 1);
+        int records_size = header->con_count * sizeof(struct controller_record);
+        if (header->flags & INPUT_FLAG_DELTA)
+            records_size = delta_section_size(records, size - sizeof(*header), header->con_count);
+        size_t edges_size = (header->flags & INPUT_FLAG_EDGES) ? header->con_count * sizeof(struct edge_record) : 0;
+        size_t used = sizeof(*header) + records_size + edges_size;
+        if (records_size < 0 || (size_t)size < used)
+            return -1;
+
+        view->con_count = header->con_count;
+        view->controllers = (header->flags & INPUT_FLAG_DELTA) ? nullptr : (const struct controller_record*)records;
+        view->delta = (header->flags & INPUT_FLAG_DELTA) ? records : nullptr;
+        view->edges = edges_size != 0 ? (const struct edge_record*)(records + records_size) : nullptr;
+        view->history_count = 0;
+        view->history = nullptr;
+
+        if (header->flags & INPUT_FLAG_HISTORY)
+        {
+            if ((size_t)size < used + sizeof(struct history_header))
+                return -1;
+            const struct history_header* history = (const struct history_header*)((const u8*)data + used);
+            used += sizeof(*history) + history->count * header->con_count * sizeof(u64);
+            if (history->count > INPUT_MAX_HISTORY || (size_t)size < used)
+                return -1;
+            view->history_count = history->count;
+            view->history = (const u8*)(history + 1);
+        }
+        info->has_seq = true;
+        info->flags = header->flags;
+        info->seq = header->seq;
+        info->send_time_us = header->send_time_us;
+        return 0;
+    }
+
+    return -1;
 }
 
+// How far behind the last applied sequence a packet can be and still count as late rather than
+// coming from a client that restarted its numbering
+#define STALE_SEQ_WINDOW 1024
+
+// Upper bound on datagrams read per wake-up in RECEIVE_MODE_DRAIN, so a flood can't starve the apply side
+#define MAX_DRAIN_READS 64
+
+static_assert(MAX_SESSIONS <= ANARCHY_MAX_SENDERS && MAX_SESSIONS <= 32, "sessions don't fit the merge or accepted_sessions");
+
+// The host id is how an IP change shows up. Asking for it is an IPC, so it's only checked every
+// HOSTID_CHECK_MS (or right after a stall), from the network thread once the input has been handed over.
+#define HOSTID_CHECK_MS 1000
+
 static u32 curIP = 0;
-static int failed = 11;
+static u64 last_hostid_check = 0;
+static bool hostid_check_due = false;
+static bool socket_broken = false; // recvfrom or poll failed with something other than a timeout
+static bool link_up = false; // Some session sent input within session_timeout_ms
 static int counter = 0;
 static struct input_message cached_message = {0};
+static struct input_info cached_info = {0};
+static u32 cached_slot_seq[MAX_CONTROLLERS] = {0};
+static u64 cached_slot_tick[MAX_CONTROLLERS] = {0};
 u64 last_time;
 
-int poll_udp_input(struct input_message *buf)
+// Full controllers of the datagrams we acknowledged lately, indexed by seq % INPUT_MAX_BASELINE_AGE
+struct input_baseline
+{
+    bool valid;
+    u32 seq;
+    u16 con_count;
+    struct controller_record controllers[MAX_CONTROLLERS];
+};
+
+// Every address input comes from gets a session and a range of controller slots of its own, so several
+// clients can play at once. Its controller i lands in slot first_slot + i, anything past slot_count is
+// dropped. Sequence numbers, delta baselines and replies are all tracked per session.
+struct client_session
+{
+    bool active;
+    struct sockaddr_in addr;
+    u64 last_tick; // Last input datagram we took from it
+    u8 first_slot;
+    u8 slot_count;
+    bool has_input;
+    struct input_info info; // Newest datagram accepted
+    struct controller_record first_controller; // Of that datagram, what anarchy mode merges
+
+    // Newest datagram that asked for replies
+    bool reply_pending;
+    u32 reply_seq;
+    u64 reply_send_time_us;
+    u64 reply_recv_tick;
+    u64 last_reply_tick;
+    // Bytes of datagrams that asked for replies and haven't been paid back yet. A reply only goes out once
+    // it covers one, so a datagram with a spoofed address never gets more sent back than it was.
+    u32 reply_budget;
+    // What its replies report, since the session started
+    u32 received;
+    u32 stale;
+    u32 lost;
+    u32 unresolved;
+
+    struct input_baseline baselines[INPUT_MAX_BASELINE_AGE];
+};
+
+static struct client_session sessions[MAX_SESSIONS];
+static u8 slot_owner[MAX_CONTROLLERS] = {0}; // Session index + 1, 0 if free
+// A slot can change hands within one drain, before the apply side ever sees the zeroed record
+static u32 slot_owner_gen[MAX_CONTROLLERS] = {0};
+// Slots below this were handed out at some point, so the frames cover them. It never shrinks, which
+// leaves a controller alone once nobody sends it anything, like before sessions.
+static u8 slot_watermark = 0;
+
+// Silent for session_timeout_ms: its slots can go to someone else, and it may restart its numbering
+static bool session_idle(const struct client_session* session, u64 now)
+{
+    return now - session->last_tick >= armNsToTicks(config.session_timeout_ms * 1000000);
+}
+
+static bool same_address(const struct sockaddr_in* a, const struct sockaddr_in* b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+// Whether addr has a session that's still sending. Log settings are only taken from one, anyone else
+// could turn on the trace.
+static bool has_live_session(const struct sockaddr_in* addr, u64 now)
+{
+    for (int s = 0; s < MAX_SESSIONS; s++)
+    {
+        const struct client_session* session = &sessions[s];
+        if (session->active && same_address(&session->addr, addr) && !session_idle(session, now))
+            return true;
+    }
+    return false;
+}
+
+// Ends idle sessions other than keep. Their controllers are zeroed, which unplugs them on the next apply.
+static void release_idle_sessions(const struct client_session* keep, u64 now)
+{
+    for (int s = 0; s < MAX_SESSIONS; s++)
+    {
+        struct client_session* session = &sessions[s];
+        if (!session->active || session == keep || !session_idle(session, now))
+            continue;
+        for (int i = session->first_slot; i < session->first_slot + session->slot_count; i++)
+        {
+            slot_owner[i] = 0;
+            memset(&cached_message.controllers[i], 0, sizeof(cached_message.controllers[i]));
+            cached_slot_tick[i] = now;
+        }
+        LOG(LOG_INFO, LOG_CAT_NET, "Session of %s:%u ended, slots %u-%u are free", inet_ntoa(session->addr.sin_addr),
+            ntohs(session->addr.sin_port), session->first_slot, session->first_slot + session->slot_count - 1);
+        session->active = false;
+        metric_set(METRIC_SESSIONS, metric_get(METRIC_SESSIONS) - 1);
+    }
+}
+
+// The session input from addr belongs to, nullptr if there's no room for another one. A client that
+// comes back from a new port after going idle takes over its old session, and with it its slots. Only
+// if that's the one session from its IP though: players behind one NAT share it, and one of them
+// pausing mustn't hand its slots to the next one that shows up.
+static struct client_session* find_session(const struct sockaddr_in* addr, u64 now)
+{
+    struct client_session* unused = nullptr;
+    struct client_session* previous = nullptr;
+    u32 same_ip = 0;
+    for (int s = 0; s < MAX_SESSIONS; s++)
+    {
+        struct client_session* session = &sessions[s];
+        if (!session->active)
+        {
+            if (unused == nullptr)
+                unused = session;
+            continue;
+        }
+        if (same_address(&session->addr, addr))
+            return session;
+        if (session->addr.sin_addr.s_addr == addr->sin_addr.s_addr)
+        {
+            same_ip++;
+            if (session_idle(session, now))
+                previous = session;
+        }
+    }
+
+    struct client_session* session = same_ip == 1 ? previous : nullptr;
+    if (session == nullptr)
+    {
+        if (unused == nullptr)
+            release_idle_sessions(nullptr, now);
+        for (int s = 0; unused == nullptr && s < MAX_SESSIONS; s++)
+        {
+            if (!sessions[s].active)
+                unused = &sessions[s];
+        }
+        if (unused == nullptr)
+            return nullptr;
+        session = unused;
+        session->first_slot = 0;
+        session->slot_count = 0;
+        session->active = true;
+        metric_add(METRIC_SESSIONS);
+    }
+
+    session->addr = *addr;
+    session->last_tick = now;
+    session->has_input = false;
+    session->reply_pending = false;
+    session->last_reply_tick = 0;
+    session->reply_budget = 0;
+    session->received = session->stale = session->lost = session->unresolved = 0;
+    for (int b = 0; b < INPUT_MAX_BASELINE_AGE; b++)
+        session->baselines[b].valid = false;
+    LOG(LOG_INFO, LOG_CAT_NET, "New session for %s:%u", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    return session;
+}
+
+// Start of the first run of at least count free slots, or of the longest one if none is that long
+static u8 find_free_run(u8 count)
 {
+    u8 first = 0;
+    u8 best = 0;
+    for (u8 start = 0; start < MAX_CONTROLLERS; start++)
+    {
+        u8 length = 0;
+        while (start + length < MAX_CONTROLLERS && slot_owner[start + length] == 0)
+            length++;
+        if (length >= count)
+            return start;
+        if (length > best)
+        {
+            best = length;
+            first = start;
+        }
+        start += length;
+    }
+    return first;
+}
+
+// Grows a session's slots to count if it can, and returns how many it has. A range only ever grows into
+// the free slots right after it, a new one goes to the first free run that's long enough (or the longest
+// there is). Idle sessions give their slots back if there aren't enough free ones.
+static u8 claim_slots(struct client_session* session, u8 count, u64 now)
+{
+    if (count > MAX_CONTROLLERS)
+        count = MAX_CONTROLLERS;
+    u8 owner = (u8)(session - sessions) + 1;
+
+    for (int pass = 0; pass < 2 && session->slot_count < count; pass++)
+    {
+        if (pass == 1)
+            release_idle_sessions(session, now);
+
+        if (session->slot_count == 0)
+            session->first_slot = find_free_run(count);
+
+        u8 end = session->first_slot + session->slot_count;
+        while (session->slot_count < count && end < MAX_CONTROLLERS && slot_owner[end] == 0)
+        {
+            slot_owner_gen[end]++;
+            slot_owner[end++] = owner;
+            session->slot_count++;
+        }
+        if (end > slot_watermark)
+            slot_watermark = end;
+    }
+    return session->slot_count;
+}
+
+// Late or duplicated datagrams would roll the controllers back, so only newer sequences get through
+static bool is_stale(const struct client_session* session, const struct input_info* info, bool restarted)
+{
+    if (!info->has_seq || !session->has_input || !session->info.has_seq || restarted)
+        return false;
+    s32 ahead = (s32)(info->seq - session->info.seq);
+    return ahead <= 0 && ahead > -STALE_SEQ_WINDOW;
+}
+
+// Datagrams missing between the session's previous accepted one and this one are rebuilt from its
+// history, and every button that changed along the way ends up in the frame's edges. Otherwise a tap
+// that lived only in a lost datagram would never reach HID. Datagrams we did get but coalesced carry
+// their own edges. In anarchy mode the first controller's go to slot 0, measured against what the
+// session itself sent last rather than the merge, unless the majority decides.
+static void fold_transitions(struct input_frame* frame, const struct input_view* view, const struct input_info* info,
+                             struct client_session* session, bool restarted, u8 slots)
+{
+    u32 missing = 0;
+    if (info->has_seq && session->has_input && session->info.has_seq && !restarted)
+    {
+        s32 ahead = (s32)(info->seq - session->info.seq);
+        if (ahead > 1 && ahead <= STALE_SEQ_WINDOW)
+            missing = ahead - 1;
+    }
+    u32 rebuilt = missing < view->history_count ? missing : view->history_count;
+    metric_add(METRIC_RECOVERED, rebuilt);
+    metric_add(METRIC_LOST, missing - rebuilt);
+    session->lost += missing - rebuilt;
+    if (rebuilt == 0)
+        return;
+
+    int count = slots;
+    if (config.anarchy)
+        count = view->con_count > 0 && config.anarchy_buttons != ANARCHY_BUTTONS_MAJORITY ? 1 : 0;
+    for (int i = 0; i < count; i++)
+    {
+        int slot = config.anarchy ? 0 : session->first_slot + i;
+        u64 newer = view->controllers[i].keys;
+        for (u32 k = 0; k <= rebuilt; k++)
+        {
+            u64 older = config.anarchy ? session->first_controller.keys : cached_message.controllers[slot].keys;
+            if (k < rebuilt)
+            {
+                u64 keys_xor;
+                memcpy(&keys_xor, view->history + (k * view->con_count + i) * sizeof(u64), sizeof(keys_xor));
+                older = newer ^ keys_xor;
+            }
+            frame->pressed[slot] |= newer & ~older;
+            frame->released[slot] |= older & ~newer;
+            newer = older;
+        }
+    }
+}
+
+static void store_baseline(struct client_session* session, const struct input_view* view, const struct input_info* info)
+{
+    struct input_baseline& baseline = session->baselines[info->seq % INPUT_MAX_BASELINE_AGE];
+    baseline.valid = true;
+    baseline.seq = info->seq;
+    baseline.con_count = view->con_count;
+    memcpy(baseline.controllers, view->controllers, view->con_count * sizeof(struct controller_record));
+}
+
+template <typename T>
+static const u8* read_field(const u8* data, T* value)
+{
+    memcpy(value, data, sizeof(T));
+    return data + sizeof(T);
+}
+
+// Applies a delta section to its baseline, writing the full controllers to out and pointing view at
+// them. False if the baseline isn't one we still have.
+static bool resolve_delta(const struct client_session* session, struct input_view* view, struct controller_record* out)
+{
+    struct delta_header header;
+    const u8* data = read_field(view->delta, &header);
+    const struct input_baseline& baseline = session->baselines[header.baseline_seq % INPUT_MAX_BASELINE_AGE];
+    if (!baseline.valid || baseline.seq != header.baseline_seq)
+        return false;
+
+    for (int i = 0; i < view->con_count; i++)
+    {
+        struct controller_record record = {0};
+        if (i < baseline.con_count)
+            record = baseline.controllers[i];
+
+        u8 fields = *data++;
+        u16 con_type = record.con_type;
+        u64 keys = record.keys;
+        s32 joy[4] = {record.joy_l_x, record.joy_l_y, record.joy_r_x, record.joy_r_y};
+        if (fields & DELTA_FIELD_CON_TYPE)
+            data = read_field(data, &con_type);
+        if (fields & DELTA_FIELD_KEYS)
+            data = read_field(data, &keys);
+        for (int j = 0; j < 4; j++)
+        {
+            if (fields & (DELTA_FIELD_JOY_L_X << j))
+                data = read_field(data, &joy[j]);
+        }
+
+        record.con_type = con_type;
+        record.keys = keys;
+        record.joy_l_x = joy[0];
+        record.joy_l_y = joy[1];
+        record.joy_r_x = joy[2];
+        record.joy_r_y = joy[3];
+        out[i] = record;
+    }
+
+    view->controllers = out;
+    return true;
+}
+
+void flush_udp_reply()
+{
+    u64 now = svcGetSystemTick();
+    u64 interval = armNsToTicks(config.reply_interval_ms * 1000000);
+
+    for (int s = 0; s < MAX_SESSIONS; s++)
+    {
+        struct client_session* session = &sessions[s];
+        if (!session->active || !session->reply_pending || now - session->last_reply_tick < interval ||
+            session->reply_budget < sizeof(struct input_reply))
+            continue;
+
+        struct input_reply reply = {0};
+        reply.magic = INPUT_REPLY_MAGIC;
+        reply.size = sizeof(reply);
+        reply.acked_seq = session->reply_seq;
+        reply.applied_seq = session->slot_count > 0 ? get_applied_seq(session->first_slot) : 0;
+        reply.echo_send_time_us = session->reply_send_time_us;
+        reply.recv_time_us = armTicksToNs(session->reply_recv_tick) / 1000;
+        reply.received = session->received;
+        reply.invalid = (u32)metric_get(METRIC_INVALID);
+        reply.stale = session->stale;
+        reply.lost = session->lost;
+        reply.unresolved = session->unresolved;
+        reply.reply_time_us = armTicksToNs(svcGetSystemTick()) / 1000;
+
+        // Never waits, a reply that doesn't fit in the socket buffer right now is simply skipped
+        sendto(sockfd, &reply, sizeof(reply), MSG_DONTWAIT, (const struct sockaddr*)&session->addr, sizeof(session->addr));
+        session->reply_pending = false;
+        session->last_reply_tick = now;
+        session->reply_budget -= sizeof(reply);
+    }
+}
+
+// Answered on the spot, any delay here would end up in the clock offset
+static void answer_time_ping(const struct time_ping* ping, int size, u64 recv_tick, const struct sockaddr_in* addr)
+{
+    struct time_pong pong;
+    if (size < (int)sizeof(pong))
+    {
+        metric_add(METRIC_INVALID);
+        return;
+    }
+    clock_sync_pong(ping, addr->sin_addr.s_addr, recv_tick, &pong);
+    sendto(sockfd, &pong, sizeof(pong), MSG_DONTWAIT, (const struct sockaddr*)addr, sizeof(*addr));
+}
+
+// Every metric that fits in a datagram the size of the request, to whoever asked
+static void answer_stats_request(const struct stats_request* request, int size, const struct sockaddr_in* addr)
+{
+    u8 datagram[sizeof(struct stats_reply) + METRIC_COUNT * sizeof(u64)];
+    struct stats_reply* reply = (struct stats_reply*)datagram;
+    u64 now = svcGetSystemTick();
+
+    if (size < (int)sizeof(*reply))
+    {
+        metric_add(METRIC_INVALID);
+        return;
+    }
+    u32 count = (size - sizeof(*reply)) / sizeof(u64);
+    if (count > METRIC_COUNT)
+        count = METRIC_COUNT;
+
+    metric_add(METRIC_STATS_REQUESTS);
+    update_slot_rates(now);
+    reply->magic = STATS_REPLY_MAGIC;
+    reply->count = count;
+    reply->id = request->id;
+    reply->uptime_us = armTicksToNs(now) / 1000;
+    for (u32 i = 0; i < count; i++)
+    {
+        u64 value = metric_get(i);
+        memcpy(datagram + sizeof(*reply) + i * sizeof(u64), &value, sizeof(value));
+    }
+    sendto(sockfd, datagram, sizeof(*reply) + count * sizeof(u64), MSG_DONTWAIT, (const struct sockaddr*)addr, sizeof(*addr));
+}
+
+// The first controller of every session that's still sending, merged into slot 0
+static struct anarchy_senders anarchy_input;
+
+static void merge_anarchy(u64 now)
+{
+    u32 count = 0;
+    for (int s = 0; s < MAX_SESSIONS; s++)
+    {
+        const struct client_session* session = &sessions[s];
+        if (!session->active || !session->has_input || session_idle(session, now))
+            continue;
+        // Sending no controller (or unplugging it) isn't playing, it mustn't vote or unplug slot 0
+        const struct controller_record& record = session->first_controller;
+        if (record.con_type == 0)
+            continue;
+        anarchy_input.con_type[count] = record.con_type;
+        anarchy_input.keys[count] = record.keys;
+        anarchy_input.joy[0][count] = record.joy_l_x;
+        anarchy_input.joy[1][count] = record.joy_l_y;
+        anarchy_input.joy[2][count] = record.joy_r_x;
+        anarchy_input.joy[3][count] = record.joy_r_y;
+        anarchy_input.tick[count] = session->info.recv_tick;
+        count++;
+    }
+    anarchy_input.count = count;
+    if (count == 0)
+        return;
+
+    anarchy_merge(&anarchy_input, config.anarchy_buttons, config.anarchy_sticks, &cached_message.controllers[0]);
+    u32 newest = anarchy_newest(anarchy_input.tick, count);
+    cached_slot_tick[0] = anarchy_input.tick[newest];
+    cached_slot_seq[0] = cached_info.seq;
+}
+
+// Sleeps until a datagram is waiting on the socket, false on timeout
+static bool wait_for_datagram(int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ready = poll(&pfd, 1, timeout_ms);
+    if ((ready < 0 && errno != EINTR) || (ready > 0 && (pfd.revents & (POLLERR | POLLNVAL))))
+        socket_broken = true;
+    return ready > 0 && (pfd.revents & POLLIN);
+}
+
+void maintain_udp_socket()
+{
+    u64 now = svcGetSystemTick();
+    if (!socket_broken && !hostid_check_due && now - last_hostid_check < armNsToTicks(HOSTID_CHECK_MS * 1000000ull))
+        return;
+
+    // A new socket is bound to whatever the address is now, so that's the one to compare against later.
+    // curIP only moves once one is, a rebuild that failed is tried again.
+    const char* reason = nullptr;
+    if (metric_get(METRIC_SOCKET_REBUILDS) == 0)
+        reason = "starting up";
+    else if (socket_broken || sockfd == -1)
+        reason = "socket error";
+    u32 ip = gethostid();
+    last_hostid_check = now;
+    hostid_check_due = false;
+    if (ip != curIP && reason == nullptr)
+        reason = "address changed";
+    if (reason == nullptr)
+        return;
+
+    if (!setup_socket())
+    {
+        // No input can come in without a socket anyway, just don't spin on it
+        socket_broken = true;
+        svcSleepThread(RECV_TIMEOUT_MS * 1000000ull);
+        return;
+    }
+    curIP = ip;
+    metric_add(METRIC_SOCKET_REBUILDS);
+    socket_broken = false;
+    LOG(LOG_INFO, LOG_CAT_NET, "Socket rebuilt (%s) in %lluus", reason,
+        (unsigned long long)(armTicksToNs(svcGetSystemTick() - now) / 1000));
+}
+
+int poll_udp_input(struct input_frame *frame)
+{
+    // RECEIVE_MODE_POLLING only reads every third call and hands out the cached message otherwise.
+    // The other modes wait on the socket and return as soon as something arrives, RECEIVE_MODE_DRAIN
+    // then also reads whatever else is queued and keeps only the newest. The jitter buffer wants to
+    // see every frame of a burst, so draining is left to it when it's on.
+    bool event_driven = config.receive_mode != RECEIVE_MODE_POLLING;
+    bool drain = config.receive_mode == RECEIVE_MODE_DRAIN && !config.jitter_buffer;
+
     // Just as mentioned before, most (if not all) of the code in the previous and current function comes from hid_mitm, so if you want to check how everything
     // works, I recommend you to check it out, it's pretty cool and well documented!
-    if (++counter != 3)
+    if (!event_driven && ++counter != 3)
     {
-        if (failed > 10)
+        if (!link_up)
             return -1;
-        *buf = cached_message;
+        frame->message = cached_message;
+        frame->info = cached_info;
+        memcpy(frame->slot_seq, cached_slot_seq, sizeof(frame->slot_seq));
+        memcpy(frame->slot_tick, cached_slot_tick, sizeof(frame->slot_tick));
+        memcpy(frame->slot_owner_gen, slot_owner_gen, sizeof(frame->slot_owner_gen));
+        memset(frame->pressed, 0, sizeof(frame->pressed));
+        memset(frame->released, 0, sizeof(frame->released));
         return 0;
     }
     counter = 0;
 
-    u64 tmp_time = svcGetSystemTick();
-    if (tmp_time - last_time > (19200000 / 10))
+    // The first socket is made by maintain_udp_socket as well
+    if (sockfd == -1)
     {
-        svcSleepThread(5e+8L);
-        setup_socket();
-        curIP = gethostid();
-        tmp_time = svcGetSystemTick();
+        socket_broken = true;
+        return -1;
     }
+
+    // Taking more than 100ms to come back here usually means the console was asleep, which can take the
+    // network down with it. maintain_udp_socket has a look right after this poll.
+    u64 tmp_time = svcGetSystemTick();
+    if (tmp_time - last_time > armGetSystemTickFreq() / 10)
+        hostid_check_due = true;
     last_time = tmp_time;
 
-    if (failed > 10 && failed % 10 != 0)
+    // Every accepted datagram goes straight into its session's slots of cached_message, so only the
+    // newest per session survives a drain
+    // Too big for the network thread's stack, and only ever used from it
+    static u8 datagram[MAX_DATAGRAM_SIZE];
+    struct controller_record resolved[MAX_CONTROLLERS];
+    struct input_view view;
+    struct input_info info;
+    struct input_info newest = {0};
+    bool accepted = false;
+    u32 accepted_sessions = 0;
+    int datagrams_read = 0;
+    u64 read_begin = 0;
+
+    // A tap that only shows up in a coalesced or lost datagram still has to reach the apply side
+    memset(frame->pressed, 0, sizeof(frame->pressed));
+    memset(frame->released, 0, sizeof(frame->released));
+
+    if (!event_driven || wait_for_datagram(RECV_TIMEOUT_MS))
     {
-        failed++;
-        return -1;
+        read_begin = svcGetSystemTick();
+        int flags = event_driven ? MSG_DONTWAIT : MSG_WAITALL;
+        for (int reads = 0; reads < (drain ? MAX_DRAIN_READS : 1); reads++)
+        {
+            socklen_t len = sizeof(cliaddr);
+            int n = recvfrom(sockfd, datagram, sizeof(datagram),
+                             flags, (struct sockaddr *)&cliaddr,
+                             &len);
+            flags = MSG_DONTWAIT;
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                socket_broken = true;
+            if (n <= 0)
+                break;
+
+            metric_add(METRIC_RECEIVED);
+            datagrams_read++;
+            info.recv_tick = svcGetSystemTick();
+
+            const struct time_ping* ping = (const struct time_ping*)datagram;
+            if (n >= (int)sizeof(*ping) && ping->magic == TIME_PING_MAGIC)
+            {
+                answer_time_ping(ping, n, info.recv_tick, &cliaddr);
+                continue;
+            }
+
+            // Monitoring isn't input, it doesn't start a session
+            const struct stats_request* request = (const struct stats_request*)datagram;
+            if (n >= (int)sizeof(*request) && request->magic == STATS_REQUEST_MAGIC)
+            {
+                answer_stats_request(request, n, &cliaddr);
+                continue;
+            }
+
+            const struct log_control* control = (const struct log_control*)datagram;
+            if (n >= (int)sizeof(*control) && control->magic == LOG_CONTROL_MAGIC)
+            {
+                if (!has_live_session(&cliaddr, info.recv_tick))
+                {
+                    metric_add(METRIC_REJECTED);
+                    continue;
+                }
+                // Said before the switch, the new settings might not include this category
+                LOG(LOG_INFO, LOG_CAT_CONFIG, "Log level %u, categories 0x%x from %s", control->level,
+                    control->categories, inet_ntoa(cliaddr.sin_addr));
+                log_configure(control->level, control->categories);
+                trace_enabled = control->trace != 0;
+                continue;
+            }
+            if (decode_input_message(datagram, n, &view, &info) != 0)
+            {
+                metric_add(METRIC_INVALID);
+                continue;
+            }
+
+            struct client_session* session = find_session(&cliaddr, info.recv_tick);
+            if (session == nullptr)
+            {
+                metric_add(METRIC_REJECTED);
+                continue;
+            }
+
+            info.session = session - sessions;
+            session->received++;
+            info.clock_offset_known = info.has_seq && clock_offset_of(cliaddr.sin_addr.s_addr, &info.clock_offset_us);
+
+            // Only datagrams we take keep the session alive. A client that restarted its numbering without
+            // pausing sends nothing but stale ones at first, and they mustn't stop it from looking restarted.
+            bool restarted = session_idle(session, info.recv_tick);
+            if (is_stale(session, &info, restarted))
+            {
+                metric_add(METRIC_STALE);
+                session->stale++;
+                continue;
+            }
+
+            if (view.delta != nullptr && !resolve_delta(session, &view, resolved))
+            {
+                metric_add(METRIC_UNRESOLVED);
+                session->unresolved++;
+                continue;
+            }
+            session->last_tick = info.recv_tick;
+
+            u32 session_bit = 1u << (session - sessions);
+            if (accepted_sessions & session_bit)
+                metric_add(METRIC_COALESCED);
+            accepted_sessions |= session_bit;
+
+            // In anarchy mode sessions don't get slots, their first controllers are merged further down.
+            // A single sender's taps are passed on unless the majority decides.
+            u8 slots = 0;
+            if (!config.anarchy)
+            {
+                slots = claim_slots(session, view.con_count, info.recv_tick);
+                if (slots > view.con_count)
+                    slots = view.con_count;
+                if (slots == 0 && view.con_count > 0)
+                    metric_add(METRIC_REJECTED);
+            }
+            else if (config.anarchy_buttons != ANARCHY_BUTTONS_MAJORITY && view.edges != nullptr && view.con_count > 0)
+            {
+                frame->pressed[0] |= view.edges[0].pressed;
+                frame->released[0] |= view.edges[0].released;
+            }
+            fold_transitions(frame, &view, &info, session, restarted, slots);
+            for (int i = 0; view.edges != nullptr && i < slots; i++)
+            {
+                frame->pressed[session->first_slot + i] |= view.edges[i].pressed;
+                frame->released[session->first_slot + i] |= view.edges[i].released;
+            }
+            info.decode_tick = svcGetSystemTick();
+            record_stage(STAGE_DECODE, info.decode_tick - info.recv_tick);
+
+            if (info.flags & INPUT_FLAG_REPLY)
+            {
+                store_baseline(session, &view, &info);
+                session->reply_pending = true;
+                session->reply_seq = info.seq;
+                session->reply_send_time_us = info.send_time_us;
+                session->reply_recv_tick = info.recv_tick;
+                session->reply_budget += n;
+                if (session->reply_budget > sizeof(struct input_reply))
+                    session->reply_budget = sizeof(struct input_reply);
+            }
+
+            memcpy(&cached_message.controllers[session->first_slot], view.controllers, slots * sizeof(struct controller_record));
+            for (int i = 0; i < slots; i++)
+            {
+                cached_slot_seq[session->first_slot + i] = info.seq;
+                cached_slot_tick[session->first_slot + i] = info.recv_tick;
+            }
+            session->info = info;
+            session->has_input = true;
+            session->first_controller = {};
+            if (view.con_count > 0)
+                session->first_controller = view.controllers[0];
+            newest = info;
+            accepted = true;
+        }
     }
 
-    if (curIP != gethostid())
+    // Waiting on the socket is expected here, only time spent outside of this function counts as a stall
+    if (event_driven)
+        last_time = svcGetSystemTick();
+
+    if (datagrams_read > 0)
+        TRACE(TRACE_RECEIVE, read_begin, newest.seq, datagrams_read);
+
+    // Controllers that stop getting input are timed out one by one on the apply side, this is only
+    // whether anyone is sending at all
+    bool was_up = link_up;
+    u64 now = svcGetSystemTick();
+    const struct client_session* live = nullptr;
+    for (int s = 0; s < MAX_SESSIONS && live == nullptr; s++)
     {
-        setup_socket();
-        curIP = gethostid();
+        if (sessions[s].active && !session_idle(&sessions[s], now))
+            live = &sessions[s];
     }
-
-    socklen_t len;
-    int n;
-    struct input_message temp_message;
-    n = recvfrom(sockfd, &temp_message, sizeof(struct input_message),
-                 MSG_WAITALL, (struct sockaddr *)&cliaddr,
-                 &len);
-    if (n <= 0 || temp_message.magic != INPUT_MSG_MAGIC)
+    link_up = live != nullptr;
+    if (was_up != link_up)
     {
-        failed++;
-        if (n > 0)
-        {
-            //printToFile("BRUH THAT MAGIC IS NOT REAL GET THE F OUT OF HERE");
-        }
+        metric_set(METRIC_LINK_UP, link_up);
+        if (was_up)
+            metric_add(METRIC_LINK_DOWNS);
+        TRACE(TRACE_LINK, 0, link_up, 0);
+        // cliaddr is only whoever sent the last datagram, a ping or stats query included
+        if (link_up)
+            LOG(LOG_INFO, LOG_CAT_NET, "Client connected from %s:%u", inet_ntoa(live->addr.sin_addr), ntohs(live->addr.sin_port));
+        else
+            LOG(LOG_INFO, LOG_CAT_NET, "No input from any client anymore");
     }
-    else
+
+    if (accepted)
     {
-        failed = 0;
-        cached_message = temp_message;
+        cached_message.magic = INPUT_MSG_MAGIC;
+        cached_message.con_count = config.anarchy ? 1 : slot_watermark;
+        cached_info = newest;
+        if (config.anarchy)
+            merge_anarchy(now);
         //printToFile("Connectivity: HUGE SUCCESS");
     }
-    *buf = cached_message;
+    frame->message = cached_message;
+    frame->info = cached_info;
+    memcpy(frame->slot_seq, cached_slot_seq, sizeof(frame->slot_seq));
+    memcpy(frame->slot_tick, cached_slot_tick, sizeof(frame->slot_tick));
+    memcpy(frame->slot_owner_gen, slot_owner_gen, sizeof(frame->slot_owner_gen));
 
-    if (failed >= 10)
+    if (!link_up)
     {
         return -1;
     }
 
-    return 0;
-}
\ No newline at end of file
+    return accepted ? 1 : 0;
+}
@@ -1,8 +1,12 @@
+#pragma once
 // Most of the UDP code comes from hid-mitm: https://github.com/jakibaki/hid-mitm
 
+#include "platform.hpp"
+#include <atomic>
+
 extern "C" {
-    #include <switch.h>
     #define INPUT_MSG_MAGIC 0x3276
+    #define INPUT_MSG_V2_MAGIC 0x3277
 
     //Controller Types:
     //0 - none (disconnect controller from switch)
@@ -14,61 +18,247 @@ extern "C" {
     //5 - Joy-Con (L)
     //6 - Joy-Con (R)
 
-    struct __attribute__((__packed__)) input_message
+    #define MAX_CONTROLLERS 8
+    // Clients sending at once. Only MAX_CONTROLLERS of them get slots, the rest is for anarchy mode
+    // where nobody needs one.
+    #define MAX_SESSIONS 32
+    // Room for the largest valid datagram: a v2 delta of 8 controllers with edges and INPUT_MAX_HISTORY
+    // frames of history comes to 2413 bytes (see the static_assert)
+    #define MAX_DATAGRAM_SIZE 2560
+
+    // One controller as it appears on the wire, in both formats
+    struct __attribute__((__packed__)) controller_record
     {
-    public:
-        u16 magic;
-        u16 con_count;
         u16 con_type;
         u64 keys;
         s32 joy_l_x;
         s32 joy_l_y;
         s32 joy_r_x;
         s32 joy_r_y;
-        u16 con_type2;
-        u64 keys2;
-        s32 joy_l_x2;
-        s32 joy_l_y2;
-        s32 joy_r_x2;
-        s32 joy_r_y2;
-        u16 con_type3;
-        u64 keys3;
-        s32 joy_l_x3;
-        s32 joy_l_y3;
-        s32 joy_r_x3;
-        s32 joy_r_y3;
-        u16 con_type4;
-        u64 keys4;
-        s32 joy_l_x4;
-        s32 joy_l_y4;
-        s32 joy_r_x4;
-        s32 joy_r_y4;
-        u16 con_type5;
-        u64 keys5;
-        s32 joy_l_x5;
-        s32 joy_l_y5;
-        s32 joy_r_x5;
-        s32 joy_r_y5;
-        u16 con_type6;
-        u64 keys6;
-        s32 joy_l_x6;
-        s32 joy_l_y6;
-        s32 joy_r_x6;
-        s32 joy_r_y6;
-        u16 con_type7;
-        u64 keys7;
-        s32 joy_l_x7;
-        s32 joy_l_y7;
-        s32 joy_r_x7;
-        s32 joy_r_y7;
-        u16 con_type8;
-        u64 keys8;
-        s32 joy_l_x8;
-        s32 joy_l_y8;
-        s32 joy_r_x8;
-        s32 joy_r_y8;
     };
 
-    int poll_udp_input(input_message* buf);
+    // Legacy format: always MAX_CONTROLLERS records, whatever con_count says. This used to be spelled out
+    // as con_type/keys/joy_*, con_type2/keys2/... up to 8, the layout is unchanged (see the static_asserts).
+    struct __attribute__((__packed__)) input_message
+    {
+    public:
+        u16 magic;
+        u16 con_count;
+        controller_record controllers[MAX_CONTROLLERS];
+    };
+
+    // v2 format: a 16 byte header followed by con_count controller_records, so a single controller
+    // is 42 bytes on the wire instead of the 212 of input_message.
+    // v2 header flags
+    #define INPUT_FLAG_EDGES 0x01   // con_count edge_records follow the controller_records
+    #define INPUT_FLAG_HISTORY 0x02 // A history block follows, after the edges if there are any
+    #define INPUT_FLAG_DELTA 0x04   // A delta section takes the place of the controller_records
+    #define INPUT_FLAG_REPLY 0x08   // Send input_replys back, the datagram can be used as a delta baseline
+    #define INPUT_FLAGS_KNOWN (INPUT_FLAG_EDGES | INPUT_FLAG_HISTORY | INPUT_FLAG_DELTA | INPUT_FLAG_REPLY)
+
+    struct __attribute__((__packed__)) input_message_v2
+    {
+        u16 magic;
+        u8 con_count;
+        u8 flags; // INPUT_FLAG_*, unknown bits make the datagram invalid
+        u32 seq; // Incremented by the client for every datagram, packets at or behind the last one applied are dropped
+        u64 send_time_us; // Client clock when the datagram was sent
+        // controller_record controllers[con_count];
+    };
+
+    // Buttons that went down / up at any point since the client's previous datagram, even if they
+    // are back where they started by the time it sent this one
+    struct __attribute__((__packed__)) edge_record
+    {
+        u64 pressed;
+        u64 released;
+    };
+
+    // Delta section: controllers as changes against an earlier datagram we acknowledged (the baseline).
+    // For each of con_count controllers a u8 of DELTA_FIELD_* bits, followed by the new value of every
+    // field that changed, in bit order and with the same types as controller_record. A controller the
+    // baseline didn't have starts out all zero. Anything without INPUT_FLAG_DELTA is a keyframe.
+    #define DELTA_FIELD_CON_TYPE 0x01
+    #define DELTA_FIELD_KEYS 0x02
+    #define DELTA_FIELD_JOY_L_X 0x04
+    #define DELTA_FIELD_JOY_L_Y 0x08
+    #define DELTA_FIELD_JOY_R_X 0x10
+    #define DELTA_FIELD_JOY_R_Y 0x20
+    #define DELTA_FIELDS_ALL 0x3f
+
+    // Only the last few acknowledged datagrams are kept, a baseline further back than this can't be used
+    #define INPUT_MAX_BASELINE_AGE 32
+
+    struct __attribute__((__packed__)) delta_header
+    {
+        u32 baseline_seq; // Must have been acknowledged in an input_reply
+        // u8 fields; <changed fields>  (con_count times)
+    };
+
+    // Sent back to clients whose newest datagram had INPUT_FLAG_REPLY, at most once every
+    // reply_interval_ms and only after its input was handed to the apply side. Not before the datagrams
+    // that asked for replies add up to the size of one either, so it can't be used to amplify traffic.
+    // Timestamps are our clock in microseconds. Counters are the client's own since its session started,
+    // except invalid: a datagram we can't decode belongs to nobody, so that one is METRIC_INVALID cut to
+    // 32 bits. A client's round-trip time is its clock now - echo_send_time_us - (reply_time_us - recv_time_us).
+    #define INPUT_REPLY_MAGIC 0x3278
+
+    struct __attribute__((__packed__)) input_reply
+    {
+        u16 magic;
+        u16 size;              // sizeof(input_reply) on our side, fields only ever get appended
+        u32 acked_seq;         // Newest datagram accepted, usable as a delta baseline from now on
+        u32 applied_seq;       // Newest datagram of this client handed to HID, 0 before the first one
+        u32 reserved;
+        u64 echo_send_time_us; // send_time_us of acked_seq, on the client's clock
+        u64 recv_time_us;      // When acked_seq arrived
+        u64 reply_time_us;     // When this reply was sent
+        u32 received;          // Input datagrams from this client
+        u32 invalid;           // From anyone
+        u32 stale;
+        u32 lost;
+        u32 unresolved;
+    };
+
+    // Clock sync, NTP style. The client sends a time_ping now and then, we answer right away with a
+    // time_pong. Its next ping says when that pong arrived, which gives us all four timestamps of the
+    // exchange and with them the offset between its clock and ours. With the offset, every v2 datagram's
+    // send_time_us tells us how long it spent on the network. Pad the ping to the size of a time_pong, a
+    // shorter one isn't answered so it can't be used to amplify traffic.
+    #define TIME_PING_MAGIC 0x3279
+    #define TIME_PONG_MAGIC 0x327a
+
+    struct __attribute__((__packed__)) time_ping
+    {
+        u16 magic;
+        u16 reserved;
+        u32 id;
+        u64 send_time_us;      // Client clock (t1)
+        u32 prev_id;           // Last pong the client got, 0 if none
+        u32 reserved2;
+        u64 prev_recv_time_us; // Client clock when it got that pong (t4)
+    };
+
+    struct __attribute__((__packed__)) time_pong
+    {
+        u16 magic;
+        u16 reserved;
+        u32 id;                // Of the ping
+        u64 ping_send_time_us; // t1, echoed
+        u64 recv_time_us;      // Our clock when the ping arrived (t2)
+        u64 send_time_us;      // Our clock when this pong went out (t3)
+        s64 offset_us;         // Our current estimate of our clock - the client's, valid if offset_known
+        u32 offset_known;
+        // Rolling percentiles over the last datagrams applied, in us, 0 until there are any
+        u32 network_p50_us;    // send_time_us -> recvfrom, needs the offset
+        u32 network_p99_us;
+        u32 queue_p50_us;      // recvfrom -> HID call done
+        u32 queue_p99_us;
+        u32 total_p50_us;
+        u32 total_p99_us;
+    };
+
+    // Monitoring: a stats_request gets a stats_reply with every metric (see metrics.hpp) back, in metric_id
+    // order. Newer builds only ever append metrics, count says how many this one has. The reply is never
+    // bigger than the request, so it can't be used to amplify traffic: pad the request to the size of the
+    // reply you want, it holds as many metrics as fit. One shorter than a stats_reply isn't answered.
+    #define STATS_REQUEST_MAGIC 0x327c
+    #define STATS_REPLY_MAGIC 0x327d
+
+    struct __attribute__((__packed__)) stats_request
+    {
+        u16 magic;
+        u16 reserved;
+        u32 id; // Echoed in the reply
+        // u8 padding[];
+    };
+
+    struct __attribute__((__packed__)) stats_reply
+    {
+        u16 magic;
+        u16 count;
+        u32 id;
+        u64 uptime_us;
+        // u64 values[count];
+    };
+
+    // Buttons of the datagrams sent just before this one, so the ones lost on the way can be rebuilt.
+    // Newest first, entry k holds for every controller the keys of frame seq - 1 - k XORed with the
+    // keys of frame seq - k. Sticks aren't repeated, the newest frame always supersedes them.
+    #define INPUT_MAX_HISTORY 32
+
+    struct __attribute__((__packed__)) history_header
+    {
+        u8 count; // At most INPUT_MAX_HISTORY
+        // u64 keys_xor[count][con_count];
+    };
+
+    // Everything we know about a datagram besides its controllers
+    struct input_info
+    {
+        bool has_seq; // Legacy packets don't carry a sequence number or timestamp
+        u8 flags;     // INPUT_FLAG_*, 0 for legacy packets
+        u32 seq;
+        u64 send_time_us;
+        u64 recv_tick;    // recvfrom returned
+        u64 decode_tick;  // Validated and accepted
+        u64 handoff_tick; // Handed to the apply thread, set by the network thread right before it does
+        u8 session;       // Index of the client session it came from
+        bool clock_offset_known; // The sender's clock offset (see clock_sync.hpp) when it arrived
+        s64 clock_offset_us;
+    };
+
+    // Controllers of a validated datagram, pointing into the receive buffer
+    struct input_view
+    {
+        u16 con_count;
+        const controller_record* controllers; // nullptr for a delta until it's resolved against its baseline
+        const u8* delta; // The delta section, nullptr for keyframes
+        const edge_record* edges; // nullptr if the datagram has none
+        u8 history_count;
+        const u8* history; // history_count * con_count unaligned u64s
+    };
+
+    // What the network thread hands over to the apply thread
+    struct input_frame
+    {
+        input_message message;
+        input_info info;
+        // Edges of every datagram folded into this frame, per controller
+        u64 pressed[MAX_CONTROLLERS];
+        u64 released[MAX_CONTROLLERS];
+        // seq of the datagram each controller came from, clients send theirs to different slots
+        u32 slot_seq[MAX_CONTROLLERS];
+        // recv_tick of that datagram, the apply side times controllers out on it
+        u64 slot_tick[MAX_CONTROLLERS];
+        // Bumped every time a slot goes to another session, the apply side unplugs the old controller
+        u32 slot_owner_gen[MAX_CONTROLLERS];
+    };
+
+    int decode_input_message(const void* data, int size, input_view* view, input_info* info);
+    // How well the apply thread keeps its schedule when apply_period_us is set, in ticks. Only the apply
+    // thread writes it, any thread can read.
+    struct scheduler_stats
+    {
+        std::atomic<u64> wakeups{0};
+        std::atomic<u64> overruns{0};    // Deadlines skipped because the previous apply ran past them
+        std::atomic<u64> jitter_sum{0};  // Sum of how late each wake-up was
+        std::atomic<u64> jitter_max{0};
+    };
+
+    // Returns 1 with a new message, 0 with the cached one and -1 while the link is down
+    int poll_udp_input(input_frame* frame);
+    // Sends the input_reply poll_udp_input left pending, if reply_interval_ms has passed since the last one
+    void flush_udp_reply();
+    // Rebuilds the socket if it failed or our IP changed, checking the IP every now and then
+    void maintain_udp_socket();
+    // seq of the newest datagram handed to HID for a controller slot, 0 before the first one
+    u32 get_applied_seq(u32 slot);
+    void apply_fake_con_state(const struct input_frame* frame);
+    u64 expire_button_latches();
+    u64 expire_idle_controllers();
     void networkThread(void* _);
+    void applyThread(void* _);
+    const scheduler_stats* get_scheduler_stats();
+    void startInputThreads();
 }